@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of times the calling thread has called operator new.  This file
+// replaces the global operator new and delete to count them, so the watcher
+// can show that decoding a signal allocates nothing in C++.  malloc calls,
+// such as those inside sd-bus, are not counted.
+uint64_t thread_allocations();
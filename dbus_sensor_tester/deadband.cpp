@@ -0,0 +1,174 @@
+#include "deadband.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <sstream>
+
+// splitmix64, a counter based generator, so any draw can be made without
+// replaying the ones before it
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Uniform in (0, 1], the streams keep the draws of one poll independent
+static double uniform(uint64_t seed, uint64_t sensor, uint64_t poll,
+                      uint64_t stream) {
+  uint64_t bits = mix(mix(mix(seed) ^ sensor) ^ (poll * 8 + stream));
+  return static_cast<double>((bits >> 11) + 1) * 0x1.0p-53;
+}
+
+// Box-Muller
+static double gaussian(uint64_t seed, uint64_t sensor, uint64_t poll,
+                       uint64_t stream) {
+  double radius =
+      std::sqrt(-2.0 * std::log(uniform(seed, sensor, poll, stream)));
+  double angle =
+      2.0 * std::numbers::pi * uniform(seed, sensor, poll, stream + 1);
+  return radius * std::cos(angle);
+}
+
+double NoiseModel::read(uint64_t sensor, uint64_t poll, double &truth) const {
+  truth += drift * gaussian(seed, sensor, poll, 0);
+  if (uniform(seed, sensor, poll, 2) <= step_probability) {
+    truth += uniform(seed, sensor, poll, 3) <= 0.5 ? -step_size : step_size;
+  }
+  double reading = truth + sigma * gaussian(seed, sensor, poll, 4);
+  if (quantum > 0.0) {
+    reading = std::round(reading / quantum) * quantum;
+  }
+  return reading;
+}
+
+std::optional<NoiseModel> load_noise_model(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open noise model " << filename << "\n";
+    return std::nullopt;
+  }
+
+  NoiseModel model;
+  try {
+    nlohmann::json json = nlohmann::json::parse(file);
+    model.seed = json.value("seed", model.seed);
+    model.drift = json.value("drift", model.drift);
+    model.sigma = json.value("sigma", model.sigma);
+    model.quantum = json.value("quantum", model.quantum);
+    model.step_probability =
+        json.value("step_probability", model.step_probability);
+    model.step_size = json.value("step_size", model.step_size);
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "Can't parse noise model " << filename << ": " << e.what()
+              << "\n";
+    return std::nullopt;
+  }
+  if (model.drift < 0.0 || model.sigma < 0.0 || model.quantum < 0.0 ||
+      model.step_probability < 0.0 || model.step_probability > 1.0) {
+    std::cerr << "Invalid noise model in " << filename << "\n";
+    return std::nullopt;
+  }
+  return model;
+}
+
+FilterDecision Deadband::apply(DeadbandState &state, double reading) const {
+  if (std::isnan(state.published)) {
+    state.published = reading;
+    return FilterDecision::publish;
+  }
+  double move = reading - state.published;
+  if (move == 0.0) {
+    return FilterDecision::unchanged;
+  }
+  double threshold = deadband;
+  if (move * state.last_move < 0.0) {
+    threshold += hysteresis;
+  }
+  if (std::abs(move) <= threshold) {
+    return FilterDecision::suppressed;
+  }
+  state.published = reading;
+  state.last_move = move;
+  return FilterDecision::publish;
+}
+
+void FilterStats::record(FilterDecision decision, const DeadbandState &state,
+                         double reading) {
+  polls++;
+  if (decision == FilterDecision::unchanged) {
+    unchanged++;
+  } else if (decision == FilterDecision::suppressed) {
+    suppressed++;
+  }
+  double reading_error = std::abs(reading - state.published);
+  reading_error_squares += reading_error * reading_error;
+  reading_error_max = std::max(reading_error_max, reading_error);
+  double truth_error = state.truth - state.published;
+  truth_error_squares += truth_error * truth_error;
+  double unfiltered_error = state.truth - reading;
+  unfiltered_truth_error_squares += unfiltered_error * unfiltered_error;
+}
+
+void FilterStats::merge(const FilterStats &other) {
+  polls += other.polls;
+  unchanged += other.unchanged;
+  suppressed += other.suppressed;
+  reading_error_squares += other.reading_error_squares;
+  reading_error_max = std::max(reading_error_max, other.reading_error_max);
+  truth_error_squares += other.truth_error_squares;
+  unfiltered_truth_error_squares += other.unfiltered_truth_error_squares;
+}
+
+double FilterStats::saved_percent() const {
+  uint64_t unfiltered = polls - unchanged;
+  if (unfiltered == 0) {
+    return 0.0;
+  }
+  return 100.0 * static_cast<double>(suppressed) /
+         static_cast<double>(unfiltered);
+}
+
+static double rms(double squares, uint64_t count) {
+  return count > 0 ? std::sqrt(squares / static_cast<double>(count)) : 0.0;
+}
+
+double FilterStats::reading_error_rms() const {
+  return rms(reading_error_squares, polls);
+}
+
+double FilterStats::truth_error_rms() const {
+  return rms(truth_error_squares, polls);
+}
+
+double FilterStats::unfiltered_truth_error_rms() const {
+  return rms(unfiltered_truth_error_squares, polls);
+}
+
+std::string FilterStats::summary() const {
+  std::ostringstream out;
+  out << polls << " readings, " << published() << " published, "
+      << suppressed << " suppressed (" << saved_percent()
+      << "% of signals saved), error vs reading rms " << reading_error_rms()
+      << " max " << reading_error_max << ", error vs truth rms "
+      << truth_error_rms() << " (unfiltered " << unfiltered_truth_error_rms()
+      << ")";
+  return out.str();
+}
+
+nlohmann::json FilterStats::to_json() const {
+  return {
+      {"readings", polls},
+      {"published", published()},
+      {"unchanged", unchanged},
+      {"suppressed", suppressed},
+      {"saved_percent", saved_percent()},
+      {"reading_error_rms", reading_error_rms()},
+      {"reading_error_max", reading_error_max},
+      {"truth_error_rms", truth_error_rms()},
+      {"unfiltered_truth_error_rms", unfiltered_truth_error_rms()},
+  };
+}
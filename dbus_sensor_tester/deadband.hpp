@@ -0,0 +1,93 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+
+// Readings of a mostly flat sensor: a slow random walk with the odd step
+// change (a fan speed change, a load coming on), plus measurement noise,
+// rounded to the ADC resolution.  Every random draw is a hash of the seed,
+// the sensor index and the poll number, so the readings of a run depend
+// only on the model and are replayed exactly by the next run with the same
+// model, however the polls happen to be timed.  A model file looks like:
+//   {"seed": 1, "drift": 0.02, "sigma": 0.1, "quantum": 0.0625,
+//    "step_probability": 0.001, "step_size": 5.0}
+struct NoiseModel {
+  uint64_t seed = 0;
+  // Standard deviation of the per poll random walk of the true value
+  double drift = 0.02;
+  // Standard deviation of the measurement noise
+  double sigma = 0.1;
+  // Readings are rounded to a multiple of this, 0 to leave them unrounded
+  double quantum = 0.0;
+  // Chance per poll of a step of +-step_size in the true value
+  double step_probability = 0.0;
+  double step_size = 0.0;
+
+  // Moves truth on by one poll and returns what the sensor reads
+  double read(uint64_t sensor, uint64_t poll, double &truth) const;
+};
+
+// Prints the problem and returns nothing if the model can't be used
+std::optional<NoiseModel> load_noise_model(const std::string &filename);
+
+// Per sensor state of the noise model and the filter
+struct DeadbandState {
+  double truth = 42.0;
+  // Last value published, what every consumer currently believes
+  double published = std::numeric_limits<double>::quiet_NaN();
+  // Direction of the last published change, for the hysteresis
+  double last_move = 0.0;
+  uint64_t polls = 0;
+};
+
+enum class FilterDecision {
+  publish,
+  // Same value as last published, no daemon would publish it
+  unchanged,
+  // Changed, but within the deadband
+  suppressed,
+};
+
+// A value is published when it moved more than deadband away from the last
+// published one.  Moving back the way the last change came takes hysteresis
+// on top, so a reading dithering around a threshold doesn't publish every
+// flip.  With both at 0 every change is published.
+struct Deadband {
+  double deadband = 0.0;
+  double hysteresis = 0.0;
+
+  // Updates the published value and direction when it decides to publish
+  FilterDecision apply(DeadbandState &state, double reading) const;
+};
+
+// What the filter saved and what it cost.  Consumers see the last published
+// value, the error is measured against the reading they would have seen
+// without the filter, and against the noise free value, with and without
+// the filter.
+struct FilterStats {
+  uint64_t polls = 0;
+  uint64_t unchanged = 0;
+  uint64_t suppressed = 0;
+  double reading_error_squares = 0.0;
+  double reading_error_max = 0.0;
+  double truth_error_squares = 0.0;
+  double unfiltered_truth_error_squares = 0.0;
+
+  void record(FilterDecision decision, const DeadbandState &state,
+              double reading);
+  void merge(const FilterStats &other);
+
+  uint64_t published() const { return polls - unchanged - suppressed; }
+  // Share of the signals an unfiltered daemon would send that were saved
+  double saved_percent() const;
+  double reading_error_rms() const;
+  double truth_error_rms() const;
+  double unfiltered_truth_error_rms() const;
+
+  std::string summary() const;
+  nlohmann::json to_json() const;
+};
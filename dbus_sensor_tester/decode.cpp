@@ -0,0 +1,157 @@
+#include "decode.hpp"
+
+#include "allocations.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+int decode_sensor_value(sd_bus_message *message, double *value) {
+  const char *interface = nullptr;
+  int r = sd_bus_message_read_basic(message, SD_BUS_TYPE_STRING, &interface);
+  if (r < 0) {
+    return r;
+  }
+  r = sd_bus_message_enter_container(message, SD_BUS_TYPE_ARRAY, "{sv}");
+  if (r < 0) {
+    return r;
+  }
+  while ((r = sd_bus_message_enter_container(
+              message, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0) {
+    const char *name = nullptr;
+    r = sd_bus_message_read_basic(message, SD_BUS_TYPE_STRING, &name);
+    if (r < 0) {
+      return r;
+    }
+    char type = 0;
+    const char *contents = nullptr;
+    r = sd_bus_message_peek_type(message, &type, &contents);
+    if (r < 0) {
+      return r;
+    }
+    // Anything else is skipped, like message.read would reject a non-double
+    // Value
+    if (std::strcmp(name, "Value") == 0 && contents != nullptr &&
+        std::strcmp(contents, "d") == 0) {
+      r = sd_bus_message_enter_container(message, SD_BUS_TYPE_VARIANT, "d");
+      if (r < 0) {
+        return r;
+      }
+      r = sd_bus_message_read_basic(message, SD_BUS_TYPE_DOUBLE, value);
+      if (r < 0) {
+        return r;
+      }
+      return 1;
+    }
+    r = sd_bus_message_skip(message, "v");
+    if (r < 0) {
+      return r;
+    }
+    r = sd_bus_message_exit_container(message);
+    if (r < 0) {
+      return r;
+    }
+  }
+  return r;
+}
+
+int read_sensor_value(sdbusplus::message_t &message, double *value) {
+  std::string interface;
+  std::vector<std::pair<std::string, std::variant<double>>> result;
+  try {
+    message.read(interface, result);
+  } catch (const sdbusplus::exception_t &) {
+    return -EBADMSG;
+  }
+  for (auto &property : result) {
+    if (property.first == "Value") {
+      *value = std::get<double>(property.second);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// What the tester publishes by default, and with --all-properties --batch
+static const std::vector<std::vector<const char *>> message_shapes = {
+    {"Value"},
+    {"MaxValue", "MinValue", "Value"},
+};
+
+static sd_bus_message *new_properties_changed(sdbusplus::bus_t &bus,
+                                              const std::vector<const char *>
+                                                  &names) {
+  sd_bus_message *message = nullptr;
+  if (sd_bus_message_new_signal(
+          bus.get(), &message,
+          "/xyz/openbmc_project/sensors/temperature/sensor0",
+          "org.freedesktop.DBus.Properties", "PropertiesChanged") < 0) {
+    return nullptr;
+  }
+  sd_bus_message_append(message, "s", "xyz.openbmc_project.Sensor.Value");
+  sd_bus_message_open_container(message, SD_BUS_TYPE_ARRAY, "{sv}");
+  for (const char *name : names) {
+    sd_bus_message_append(message, "{sv}", name, "d", 42.0);
+  }
+  sd_bus_message_close_container(message);
+  sd_bus_message_append(message, "as", 0);
+  if (sd_bus_message_seal(message, 1, 0) < 0) {
+    sd_bus_message_unref(message);
+    return nullptr;
+  }
+  return message;
+}
+
+template <typename Decoder>
+static void time_decoder(const char *label, size_t properties,
+                         sd_bus_message *message, size_t iterations,
+                         Decoder decoder) {
+  double value = 0.0;
+  uint64_t allocations = thread_allocations();
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (size_t iteration = 0; iteration < iterations; iteration++) {
+    sd_bus_message_rewind(message, 1);
+    if (decoder(message, &value) <= 0) {
+      std::cerr << label << " failed to decode the signal\n";
+      return;
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  allocations = thread_allocations() - allocations;
+
+  double count = static_cast<double>(iterations);
+  std::cout << std::left << std::setw(20) << label << std::right
+            << std::setw(12) << properties << std::fixed
+            << std::setprecision(1) << std::setw(12) << elapsed.count() / count
+            << std::setw(18)
+            << static_cast<double>(allocations) / count << "\n";
+}
+
+void run_decode_benchmark(sdbusplus::bus_t &bus, size_t iterations) {
+  std::cout << std::left << std::setw(20) << "decoder" << std::right
+            << std::setw(12) << "properties" << std::setw(12) << "ns"
+            << std::setw(18) << "C++ allocations" << "\n";
+  for (const std::vector<const char *> &names : message_shapes) {
+    sd_bus_message *raw = new_properties_changed(bus, names);
+    if (raw == nullptr) {
+      std::cerr << "Can't create a PropertiesChanged signal\n";
+      return;
+    }
+    sdbusplus::message_t message(raw);
+    sd_bus_message_unref(raw);
+
+    time_decoder("message.read", names.size(), message.get(), iterations,
+                 [&message](sd_bus_message *, double *value) {
+                   return read_sensor_value(message, value);
+                 });
+    time_decoder("sd_bus_message", names.size(), message.get(), iterations,
+                 decode_sensor_value);
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sdbusplus/bus.hpp>
+#include <sdbusplus/message.hpp>
+#include <systemd/sd-bus.h>
+
+#include <cstddef>
+
+// Both decoders take a PropertiesChanged signal and return a negative errno
+// if it is malformed, 0 if it doesn't change a "Value" property, or 1 with
+// the new value stored in value.
+
+// Walks the message with sd_bus_message primitives, comparing property
+// names in place, so nothing is allocated with operator new
+int decode_sensor_value(sd_bus_message *message, double *value);
+
+// Unpacks the whole message into a std::string and a vector of
+// name/variant pairs with message.read, as the watcher always did
+int read_sensor_value(sdbusplus::message_t &message, double *value);
+
+// Decodes the same PropertiesChanged signal iterations times with each
+// decoder and prints the time and C++ allocations per decode.  bus is only
+// used to create the message, nothing is sent.
+void run_decode_benchmark(sdbusplus::bus_t &bus, size_t iterations);
@@ -0,0 +1,116 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+size_t Histogram::bucket_index(uint64_t value) {
+  if (value < sub_bucket_count) {
+    return static_cast<size_t>(value);
+  }
+  unsigned magnitude = static_cast<unsigned>(std::bit_width(value)) - 1;
+  unsigned shift = magnitude - sub_bucket_bits;
+  return static_cast<size_t>((shift + 1) * sub_bucket_count +
+                             ((value >> shift) - sub_bucket_count));
+}
+
+uint64_t Histogram::bucket_highest_value(size_t index) {
+  if (index < sub_bucket_count) {
+    return index;
+  }
+  uint64_t shift = index / sub_bucket_count - 1;
+  uint64_t sub_bucket = index % sub_bucket_count;
+  uint64_t lowest = (sub_bucket_count + sub_bucket) << shift;
+  return lowest + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::record(std::chrono::nanoseconds value) {
+  uint64_t ns = value.count() < 0 ? 0 : static_cast<uint64_t>(value.count());
+  buckets[bucket_index(ns)]++;
+  total++;
+  sum += ns;
+  lowest = std::min(lowest, ns);
+  highest = std::max(highest, ns);
+}
+
+void Histogram::merge(const Histogram &other) {
+  for (size_t index = 0; index < bucket_count; index++) {
+    buckets[index] += other.buckets[index];
+  }
+  total += other.total;
+  sum += other.sum;
+  lowest = std::min(lowest, other.lowest);
+  highest = std::max(highest, other.highest);
+}
+
+void Histogram::reset() { *this = Histogram(); }
+
+std::chrono::nanoseconds Histogram::min() const {
+  return std::chrono::nanoseconds(total == 0 ? 0 : lowest);
+}
+
+std::chrono::nanoseconds Histogram::max() const {
+  return std::chrono::nanoseconds(highest);
+}
+
+std::chrono::nanoseconds Histogram::mean() const {
+  return std::chrono::nanoseconds(total == 0 ? 0 : sum / total);
+}
+
+std::chrono::nanoseconds Histogram::percentile(double percentile) const {
+  if (total == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  percentile = std::clamp(percentile, 0.0, 100.0);
+  uint64_t wanted = static_cast<uint64_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(total)));
+  wanted = std::max(wanted, uint64_t{1});
+
+  uint64_t seen = 0;
+  for (size_t index = 0; index < bucket_count; index++) {
+    seen += buckets[index];
+    if (seen >= wanted) {
+      return std::chrono::nanoseconds(
+          std::min(bucket_highest_value(index), highest));
+    }
+  }
+  return max();
+}
+
+static double to_micros(std::chrono::nanoseconds value) {
+  return std::chrono::duration<double, std::micro>(value).count();
+}
+
+std::string Histogram::summary() const {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1) << "n=" << total
+      << " p50=" << to_micros(percentile(50.0))
+      << "us p90=" << to_micros(percentile(90.0))
+      << "us p99=" << to_micros(percentile(99.0))
+      << "us p99.9=" << to_micros(percentile(99.9))
+      << "us max=" << to_micros(max()) << "us";
+  return out.str();
+}
+
+nlohmann::json Histogram::to_json() const {
+  nlohmann::json::array_t populated;
+  for (size_t index = 0; index < bucket_count; index++) {
+    if (buckets[index] != 0) {
+      populated.push_back(
+          {{"le_ns", bucket_highest_value(index)}, {"count", buckets[index]}});
+    }
+  }
+  return {
+      {"count", total},
+      {"min_ns", min().count()},
+      {"mean_ns", mean().count()},
+      {"p50_ns", percentile(50.0).count()},
+      {"p90_ns", percentile(90.0).count()},
+      {"p99_ns", percentile(99.0).count()},
+      {"p99_9_ns", percentile(99.9).count()},
+      {"max_ns", max().count()},
+      {"buckets", populated},
+  };
+}
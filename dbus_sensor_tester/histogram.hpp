@@ -0,0 +1,47 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Latency histogram with logarithmic buckets, in the spirit of HdrHistogram.
+// Every power of two is split into sub_bucket_count linear buckets, so any
+// recorded value is reported with a relative error below
+// 1 / sub_bucket_count regardless of its magnitude, in constant memory.
+class Histogram {
+public:
+  static constexpr unsigned sub_bucket_bits = 5;
+  static constexpr uint64_t sub_bucket_count = 1U << sub_bucket_bits;
+  static constexpr size_t bucket_count = (64 - sub_bucket_bits + 1) *
+                                         sub_bucket_count;
+
+  void record(std::chrono::nanoseconds value);
+  void merge(const Histogram &other);
+  void reset();
+
+  uint64_t count() const { return total; }
+  std::chrono::nanoseconds min() const;
+  std::chrono::nanoseconds max() const;
+  std::chrono::nanoseconds mean() const;
+
+  // percentile is in the range [0, 100]
+  std::chrono::nanoseconds percentile(double percentile) const;
+
+  // One line summary with p50/p90/p99/p99.9/max in microseconds
+  std::string summary() const;
+
+  nlohmann::json to_json() const;
+
+private:
+  static size_t bucket_index(uint64_t value);
+  static uint64_t bucket_highest_value(size_t index);
+
+  std::array<uint64_t, bucket_count> buckets{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t lowest = UINT64_MAX;
+  uint64_t highest = 0;
+};
@@ -1,56 +1,411 @@
 #include <CLI/App.hpp>
 #include <CLI/Config.hpp>
 #include <CLI/Formatter.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <chrono>
+#include <csignal>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <sdbusplus/asio/connection.hpp>
 #include <sdbusplus/asio/object_server.hpp>
+#include <thread>
+
+#include "allocations.hpp"
+#include "decode.hpp"
+#include "histogram.hpp"
+#include "pipeline_client.hpp"
+#include "private_bus.hpp"
+#include "probe.hpp"
+#include "read_client.hpp"
+#include "registration_benchmark.hpp"
+#include "replay.hpp"
+#include "resources.hpp"
+#include "results.hpp"
+#include "sensor_cache.hpp"
+#include "sensor_shard.hpp"
+#include "settle.hpp"
+#include "shm_snapshot.hpp"
+#include "soak.hpp"
+#include "watcher_pool.hpp"
+
+#ifndef SENSOR_TESTER_BUILD_TYPE
+#define SENSOR_TESTER_BUILD_TYPE "unknown"
+#endif
 
 boost::asio::io_context io;
-std::vector<std::shared_ptr<sdbusplus::asio::dbus_interface>> sensorInterfaces;
 
-int update_interval_seconds = 1;
+constexpr std::chrono::seconds report_interval(1);
+
+// Total sensor updates per second across all shards, 0 to sweep all sensors
+// every update interval instead
+double update_rate = 0.0;
 
 size_t reads = 0;
+// operator new calls made by the -w signal handler, 0 in steady state with
+// the sd_bus_message decoder
+uint64_t handler_allocations = 0;
+
+// Publish probes instead of sawtooth values, and measure them when watching
+bool end_to_end = false;
+ProbeTracker probe_tracker;
+
+// Every shard after the first gets its own connection, io_context and thread
+struct ShardThread {
+  boost::asio::io_context io;
+  std::unique_ptr<SensorShard> shard;
+  std::thread thread;
+};
+std::vector<SensorShard *> shards;
+
+std::unique_ptr<ReadClient> read_client;
+ReadStats read_stats_total;
+
+// Pipelined coroutine calls, one window depth after another
+std::unique_ptr<PipelineClient> pipeline_client;
+
+// Signals and method calls of a capture, sent again
+std::unique_ptr<Replayer> replayer;
+ReplayStats replay_stats_total;
+
+// Latency of each set_property call, and time spent handling each watched
+// signal.  The interval histograms are printed and folded into the totals on
+// every report, the totals are what gets dumped on exit.
+Histogram update_latency_total;
+Histogram signal_latency;
+Histogram signal_latency_total;
+
+// Latest value of every watched sensor, served to readers under a name of
+// its own
+std::unique_ptr<SensorCache> sensor_cache;
+
+// What the deadband saved and cost over the whole run
+FilterStats filter_total;
 
-void on_loop(boost::asio::steady_timer *timer,
-             const boost::system::error_code &error) {
+// Time spent writing the shared memory snapshot, and what its poller saw
+Histogram snapshot_latency_total;
+std::unique_ptr<ShmPoller> shm_poller;
+PollStats shm_stats_total;
 
+// Watcher connections with many match rules each, and the delivery latency
+// they saw over the whole run
+std::unique_ptr<WatcherPool> watcher_pool;
+Histogram delivery_latency_total;
+
+// CPU, memory and context switches of the tester and of the bus broker
+std::optional<ResourceMonitor> tester_resources;
+std::optional<ResourceMonitor> broker_resources;
+
+// Interval samples for --json and --csv
+RunResults run_results;
+// A soak run only keeps them when they are written, every one kept is tester
+// memory growing with the length of the run
+bool keep_samples = true;
+std::unique_ptr<SoakRecorder> soak;
+std::chrono::steady_clock::time_point report_start;
+
+void print_interval_latency(const Histogram &update_latency) {
+  if (update_latency.count() > 0) {
+    std::cout << "set_property latency: " << update_latency.summary() << "\n";
+  }
+  if (signal_latency.count() > 0) {
+    std::cout << "signal handling latency: " << signal_latency.summary()
+              << "\n";
+  }
+  update_latency_total.merge(update_latency);
+  signal_latency_total.merge(signal_latency);
+  signal_latency.reset();
+  probe_tracker.print_interval();
+}
+
+// Whole run latency histograms, folding in whatever the reporter has not
+// picked up yet
+nlohmann::json latency_json() {
+  for (SensorShard *shard : shards) {
+    UpdateStats rest = shard->take_stats();
+    update_latency_total.merge(rest.latency);
+    snapshot_latency_total.merge(rest.snapshot_latency);
+    filter_total.merge(rest.filter);
+  }
+  signal_latency_total.merge(signal_latency);
+  signal_latency.reset();
+  nlohmann::json output = {
+      {"set_property", update_latency_total.to_json()},
+      {"signal", signal_latency_total.to_json()},
+  };
+  if (watcher_pool) {
+    delivery_latency_total.merge(watcher_pool->take_stats().latency);
+    output["delivery"] = delivery_latency_total.to_json();
+  }
+  if (end_to_end) {
+    output["end_to_end"] = probe_tracker.to_json();
+  }
+  if (filter_total.polls > 0) {
+    output["deadband"] = filter_total.to_json();
+  }
+  if (snapshot_latency_total.count() > 0) {
+    output["shm_publish"] = snapshot_latency_total.to_json();
+  }
+  if (shm_poller) {
+    shm_stats_total.merge(shm_poller->take_stats());
+    nlohmann::json visible = shm_stats_total.latency.to_json();
+    visible["values"] = shm_stats_total.values;
+    visible["overwritten"] = shm_stats_total.overwritten;
+    visible["retries"] = shm_stats_total.retries;
+    visible["polls"] = shm_stats_total.polls;
+    visible["idle_polls"] = shm_stats_total.idle_polls;
+    visible["cpu_percent"] = shm_stats_total.cpu_percent();
+    if (shm_stats_total.values > 0) {
+      visible["cpu_ns_per_value"] =
+          static_cast<uint64_t>(shm_stats_total.cpu.count()) /
+          shm_stats_total.values;
+    }
+    output["shm_visible"] = visible;
+  }
+  if (read_client) {
+    read_stats_total.merge(read_client->take_stats());
+    nlohmann::json read = read_stats_total.latency.to_json();
+    read["method"] = read_client->method_name();
+    read["objects"] = read_client->object_count();
+    read["replies"] = read_stats_total.replies;
+    read["errors"] = read_stats_total.errors;
+    read["reply_bytes"] = read_stats_total.reply_bytes;
+    output["read"] = read;
+  }
+  return output;
+}
+
+bool write_histogram_json(const std::string &filename,
+                          const nlohmann::json &output) {
+  std::ofstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open " << filename << " for writing\n";
+    return false;
+  }
+  file << output.dump(2) << "\n";
+  return true;
+}
+
+void on_report(boost::asio::steady_timer *timer,
+               const boost::system::error_code &error) {
   if (error) {
     return;
   }
-  std::chrono::steady_clock::time_point start =
-      std::chrono::steady_clock::now();
 
-  static double value = -100.0;
+  UpdateStats interval;
+  for (SensorShard *shard : shards) {
+    interval.merge(shard->take_stats());
+  }
+  IntervalSample sample;
+  sample.elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - report_start)
+                       .count();
+  sample.updates = interval.updates;
+  sample.signals = interval.signals;
+  sample.unchanged = interval.unchanged;
+  sample.suppressed = interval.filter.suppressed;
+  sample.missed_deadlines = interval.missed_deadlines;
+  sample.reads = reads;
+  sample.set_property_p50 = interval.latency.percentile(50.0);
+  sample.set_property_p99 = interval.latency.percentile(99.0);
+  sample.schedule_lag_p99 = interval.schedule_lag.percentile(99.0);
+  sample.signal_p50 = signal_latency.percentile(50.0);
+  sample.signal_p99 = signal_latency.percentile(99.0);
 
-  for (auto &sensor : sensorInterfaces) {
-    if (!sensor->set_property("Value", value)) {
-      std::cout << "Can't set property for sensor\n";
+  if (interval.updates > 0 && update_rate > 0.0) {
+    std::cout << interval.updates << " updates, target "
+              << update_rate * std::chrono::duration<double>(report_interval)
+                                   .count()
+              << "\n";
+  } else if (interval.updates > 0 && interval.longest_sweep.count() > 0) {
+    std::cout << interval.updates << " updates took "
+              << std::chrono::duration_cast<std::chrono::duration<float>>(
+                     interval.longest_sweep)
+                     .count()
+              << " seconds";
+    if (shards.size() > 1) {
+      std::cout << " (slowest of " << shards.size() << " connections)";
     }
-    value += 10.0;
-    if (value >= 100.0) {
-      value = -100.0;
+    std::cout << "\n";
+  } else if (interval.updates > 0) {
+    std::cout << interval.updates << " updates\n";
+  }
+
+  // Sensor traffic is what the CPU is spent on, updates when producing and
+  // signals read when only watching
+  uint64_t events = interval.updates > 0 ? interval.updates : reads;
+  const char *event_name = interval.updates > 0 ? "updates" : "signals read";
+  if (std::optional<ResourceInterval> usage = tester_resources->sample()) {
+    std::cout << "tester: " << usage->summary(events, event_name) << "\n";
+    sample.tester_cpu_percent = usage->cpu_percent();
+    sample.tester_rss_bytes = usage->rss_bytes;
+  }
+  std::optional<ResourceInterval> broker_usage;
+  if (broker_resources) {
+    broker_usage = broker_resources->sample();
+    if (broker_usage) {
+      std::cout << "broker: " << broker_usage->summary(events, event_name)
+                << "\n";
+      sample.broker_cpu_percent = broker_usage->cpu_percent();
+      sample.broker_rss_bytes = broker_usage->rss_bytes;
+    } else {
+      std::cout << "Broker went away, no longer accounting it\n";
+      broker_resources.reset();
     }
   }
-  if (!sensorInterfaces.empty()) {
-    std::cout << sensorInterfaces.size() << " updates took "
-              << std::chrono::duration_cast<std::chrono::duration<float>>(
-                     std::chrono::steady_clock::now() - start)
-                     .count()
-              << " seconds\n";
+
+  if (watcher_pool) {
+    WatchStats watched = watcher_pool->take_stats();
+    sample.deliveries = watched.deliveries;
+    sample.delivery_p50 = watched.latency.percentile(50.0);
+    sample.delivery_p99 = watched.latency.percentile(99.0);
+    std::cout << watched.deliveries << " signals delivered to "
+              << watcher_pool->watcher_count() << " watchers";
+    // What the broker spends routing, matching included, per signal it
+    // received and per copy it delivered
+    if (broker_usage && interval.signals > 0) {
+      std::cout << ", broker cpu "
+                << broker_usage->cpu.count() /
+                       static_cast<int64_t>(interval.signals)
+                << "ns per signal";
+    }
+    if (broker_usage && watched.deliveries > 0) {
+      std::cout << ", broker cpu "
+                << broker_usage->cpu.count() /
+                       static_cast<int64_t>(watched.deliveries)
+                << "ns per delivery";
+    }
+    std::cout << "\n";
+    if (watched.latency.count() > 0) {
+      std::cout << "delivery latency: " << watched.latency.summary() << "\n";
+    }
+    delivery_latency_total.merge(watched.latency);
+    if (soak) {
+      soak->record_latency(SoakSeries::delivery, watched.latency);
+    }
+  }
+
+  sample.shm_publish_p50 = interval.snapshot_latency.percentile(50.0);
+  sample.shm_publish_p99 = interval.snapshot_latency.percentile(99.0);
+  if (interval.snapshot_latency.count() > 0) {
+    std::cout << "shm publish latency: "
+              << interval.snapshot_latency.summary() << "\n";
+  }
+  snapshot_latency_total.merge(interval.snapshot_latency);
+  if (shm_poller) {
+    PollStats polled = shm_poller->take_stats();
+    sample.shm_values = polled.values;
+    sample.shm_p50 = polled.latency.percentile(50.0);
+    sample.shm_p99 = polled.latency.percentile(99.0);
+    sample.shm_cpu_percent = polled.cpu_percent();
+    std::cout << "shm: " << polled.values << " values seen in "
+              << polled.polls << " polls (" << polled.idle_polls
+              << " idle), " << polled.overwritten << " overwritten, "
+              << polled.retries << " retries, cpu " << polled.cpu_percent()
+              << "%";
+    if (polled.values > 0) {
+      std::cout << ", " << polled.cpu.count() /
+                               static_cast<int64_t>(polled.values)
+                << "ns per value";
+    }
+    std::cout << "\n";
+    if (polled.latency.count() > 0) {
+      std::cout << "shm visible latency: " << polled.latency.summary()
+                << "\n";
+    }
+    shm_stats_total.merge(polled);
+  }
+
+  if (interval.filter.polls > 0) {
+    std::cout << "deadband: " << interval.filter.summary() << "\n";
+  }
+  filter_total.merge(interval.filter);
+
+  if (interval.unchanged > 0) {
+    std::cout << "Skipped " << interval.unchanged << " unchanged values\n";
+  }
+  if (interval.signals != interval.updates) {
+    std::cout << "Emitted " << interval.signals
+              << " PropertiesChanged signals\n";
+  }
+  if (interval.missed_deadlines > 0 || update_rate > 0.0) {
+    std::cout << "Missed " << interval.missed_deadlines
+              << " update deadlines, schedule lag: "
+              << interval.schedule_lag.summary() << "\n";
   }
 
   if (reads > 0) {
-    std::cout << "Read " << reads << " sensor updates\n";
+    std::cout << "Read " << reads << " sensor updates, "
+              << handler_allocations
+              << " C++ allocations while handling them\n";
+    handler_allocations = 0;
     reads = 0;
   }
+  if (sensor_cache) {
+    CacheStats cache = sensor_cache->take_stats();
+    std::cout << "cache: " << cache.sensors << " sensors, " << cache.updates
+              << " updates, " << cache.values_served
+              << " values served, oldest value "
+              << std::chrono::duration_cast<std::chrono::duration<float>>(
+                     cache.oldest)
+                     .count()
+              << " seconds old\n";
+  }
+  if (soak) {
+    soak->record_latency(SoakSeries::set_property, interval.latency);
+    soak->record_latency(SoakSeries::signal, signal_latency);
+  }
+  print_interval_latency(interval.latency);
+
+  if (replayer) {
+    ReplayStats replayed = replayer->take_stats();
+    std::cout << "replay: " << replayed.signals << " signals, "
+              << replayed.calls << " calls, " << replayed.replies
+              << " replies, " << replayed.errors << " errors, "
+              << replayer->remaining() << " messages left\n";
+    if (replayed.lag.count() > 0) {
+      std::cout << "replay lag: " << replayed.lag.summary() << "\n";
+    }
+    if (replayed.call_latency.count() > 0) {
+      std::cout << "replayed call latency: "
+                << replayed.call_latency.summary() << "\n";
+    }
+    replay_stats_total.merge(replayed);
+  }
+
+  if (read_client) {
+    ReadStats read_stats = read_client->take_stats();
+    sample.read_replies = read_stats.replies;
+    sample.read_errors = read_stats.errors;
+    sample.read_p50 = read_stats.latency.percentile(50.0);
+    sample.read_p99 = read_stats.latency.percentile(99.0);
+    if (read_stats.replies > 0) {
+      uint64_t bytes_per_reply = read_stats.reply_bytes / read_stats.replies;
+      std::cout << read_stats.replies << " " << read_client->method_name()
+                << " replies, " << bytes_per_reply << " bytes per reply";
+      if (read_client->object_count() > 0) {
+        std::cout << " for " << read_client->object_count() << " objects";
+      }
+      std::cout << ", " << read_stats.errors << " errors\n";
+      std::cout << "read latency: " << read_stats.latency.summary() << "\n";
+    } else if (read_stats.errors > 0) {
+      std::cout << read_stats.errors << " " << read_client->method_name()
+                << " calls failed\n";
+    }
+    read_stats_total.merge(read_stats);
+  }
+  if (soak) {
+    soak->end_interval(sample);
+  }
+  if (keep_samples) {
+    run_results.add_sample(sample);
+  }
 
-  timer->expires_from_now(std::chrono::seconds(update_interval_seconds));
-  timer->async_wait(std::bind_front(on_loop, timer));
+  timer->expires_at(timer->expiry() + report_interval);
+  timer->async_wait(std::bind_front(on_report, timer));
 };
 
 int main(int argc, const char **argv) {
@@ -59,69 +414,702 @@ int main(int argc, const char **argv) {
   size_t number_of_sensors = 0;
   app.add_option("-n", number_of_sensors, "Number of sensors to create");
 
+  ShardConfig shard_config;
+
   bool watch_sensor_updates = false;
   app.add_flag("-w", watch_sensor_updates,
                "Watch for all sensor values from dbus");
+
+  size_t number_of_connections = 1;
+  app.add_option("-j,--connections", number_of_connections,
+                 "Number of connections, each with its own thread, to "
+                 "spread the sensors across")
+      ->check(CLI::PositiveNumber);
+
+  double update_interval_seconds = 1.0;
+  app.add_option("-i,--interval", update_interval_seconds,
+                 "Seconds between sweeps updating every sensor")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("-r,--rate", update_rate,
+                 "Target sensor updates per second across all sensors, "
+                 "paced evenly instead of swept")
+      ->check(CLI::PositiveNumber);
+
+  std::string profile;
+  app.add_option("-p,--profile", profile,
+                 "JSON workload profile of sensor types, counts, periods, "
+                 "jitter and change probability, replacing -n, -i and -r")
+      ->check(CLI::ExistingFile);
+
+  app.add_flag("-e,--end-to-end", end_to_end,
+               "Publish sequence numbered, timestamped values, and measure "
+               "delivery latency, drops and reordering when watching");
+
+  app.add_flag("--all-properties", shard_config.all_properties,
+               "Change MaxValue, MinValue and thresholds along with Value, "
+               "emitting one signal per property");
+  app.add_flag("--batch", shard_config.batch_properties,
+               "Change the same properties as --all-properties, but emit one "
+               "signal per interface");
+  app.add_flag("--thresholds", shard_config.thresholds,
+               "Add Threshold.Warning and Threshold.Critical interfaces to "
+               "every sensor");
+
+  std::string service = "xyz.openbmc_project.SensorTester";
+  app.add_option("--service", service,
+                 "Bus name to claim for the sensors, and to read them from")
+      ->capture_default_str();
+
+  std::string read_method;
+  app.add_option("--read", read_method,
+                 "Read the sensors of --service with Get, GetAll or "
+                 "GetManagedObjects calls")
+      ->check(CLI::IsMember({"get", "getall", "managed"}));
+
+  size_t read_concurrency = 1;
+  app.add_option("--read-concurrency", read_concurrency,
+                 "Number of read calls kept in flight")
+      ->check(CLI::PositiveNumber);
+
+  std::string pipeline_method;
+  app.add_option("--pipeline", pipeline_method,
+                 "Call Get, Set or GetAll on the sensors of --service from "
+                 "coroutines, with every --window depth in turn, then exit")
+      ->check(CLI::IsMember({"get", "set", "getall"}));
+  std::vector<size_t> windows = {1, 2, 4, 8, 16, 32, 64};
+  app.add_option("--window", windows,
+                 "Calls --pipeline keeps in flight, a comma separated list")
+      ->delimiter(',')
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  double window_seconds = 2.0;
+  app.add_option("--window-duration", window_seconds,
+                 "Seconds to run each --window depth for")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  std::string replay;
+  app.add_option("--replay", replay,
+                 "Send the signals and method calls of a pcap capture, as "
+                 "read by dbus-pcap, again, then exit")
+      ->check(CLI::ExistingFile);
+  double replay_speed = 1.0;
+  app.add_option("--replay-speed", replay_speed,
+                 "How much faster than captured to replay, 0 for as fast as "
+                 "possible")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+
+  double duration_seconds = 0.0;
+  app.add_option("--duration", duration_seconds,
+                 "Seconds to run before exiting, 0 to run until interrupted")
+      ->check(CLI::NonNegativeNumber);
+
+  bool soak_mode = false;
+  app.add_flag("--soak", soak_mode,
+               "Keep per-bucket latency percentiles and tester and broker "
+               "RSS, and fail at exit if memory or p99 trend upwards");
+  size_t soak_bucket_seconds = 60;
+  app.add_option("--soak-bucket", soak_bucket_seconds,
+                 "Seconds of report intervals aggregated into one bucket")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  size_t soak_buckets = 10080;
+  app.add_option("--soak-history", soak_buckets,
+                 "Latest buckets kept for the trend, older ones are dropped")
+      ->check(CLI::Range(size_t{3}, std::numeric_limits<size_t>::max()))
+      ->capture_default_str();
+  size_t soak_warmup_seconds = 60;
+  app.add_option("--soak-warmup", soak_warmup_seconds,
+                 "Seconds at the start left out of the buckets")
+      ->capture_default_str();
+  SoakThresholds soak_thresholds;
+  app.add_option("--max-rss-growth", soak_thresholds.max_rss_growth_kib,
+                 "KiB per hour the tester or broker RSS may grow in a soak")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+  app.add_option("--max-p99-growth", soak_thresholds.max_p99_growth_percent,
+                 "Percent any p99 may grow over a soak")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+
+  app.add_flag("--writable", shard_config.writable,
+               "Let clients Set the Value of the sensors, implied by "
+               "--pipeline set");
+
+  std::string announce = "immediate";
+  app.add_option("--announce", announce,
+                 "How new sensors are announced: InterfacesAdded per "
+                 "interface as they register, per object after all are "
+                 "registered, or only by claiming the bus name afterwards. "
+                 "Only the main connection claims the name, so name-owner "
+                 "is limited to -j 1")
+      ->check(CLI::IsMember({"immediate", "per-path", "name-owner"}))
+      ->capture_default_str();
+
+  bool measure_settle = false;
+  app.add_flag("--settle", measure_settle,
+               "Measure how long the broker and the object mapper take to "
+               "catch up with the announced sensors, and check the "
+               "InterfacesAdded signals against --announce");
+
+  bool cache = false;
+  app.add_flag("--cache", cache,
+               "Watch like -w and keep the latest value of every sensor, "
+               "serving them with Get, GetAll and GetManagedObjects under "
+               "--cache-service");
+  std::string cache_service = "xyz.openbmc_project.SensorCache";
+  app.add_option("--cache-service", cache_service,
+                 "Bus name the sensor cache is served under")
+      ->capture_default_str();
+
+  std::string noise;
+  app.add_option("--noise", noise,
+                 "Publish readings of a JSON noise model through the "
+                 "deadband instead of the sawtooth or random walk")
+      ->check(CLI::ExistingFile);
+  app.add_option("--deadband", shard_config.deadband.deadband,
+                 "With --noise, only publish values that moved more than "
+                 "this from the last published value")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+  app.add_option("--hysteresis", shard_config.deadband.hysteresis,
+                 "With --noise, how much further a value has to move to "
+                 "publish a change back the way the last one came")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+
+  std::string shm;
+  app.add_option("--shm", shm,
+                 "Also publish every sensor value into a seqlock protected "
+                 "snapshot in /dev/shm under this name");
+  std::string shm_poll;
+  app.add_option("--shm-poll", shm_poll,
+                 "Poll the --shm snapshot of this name, from this or "
+                 "another tester");
+  uint32_t shm_poll_interval_us = 1000;
+  app.add_option("--shm-poll-interval", shm_poll_interval_us,
+                 "Microseconds between --shm-poll passes, 0 to spin")
+      ->capture_default_str();
+
+  std::string decoder = "sdbus";
+  app.add_option("--decoder", decoder,
+                 "How -w decodes PropertiesChanged: in place with "
+                 "sd_bus_message calls, or into strings and vectors with "
+                 "message.read")
+      ->check(CLI::IsMember({"sdbus", "read"}))
+      ->capture_default_str();
+
+  size_t decode_benchmark = 0;
+  app.add_option("--decode-benchmark", decode_benchmark,
+                 "Decode a PropertiesChanged signal this many times with "
+                 "each decoder, print the cost per decode, then exit. Only "
+                 "C++ allocations are counted, not malloc calls inside "
+                 "sd-bus");
+
+  bool registration_benchmark = false;
+  app.add_flag("--registration-benchmark", registration_benchmark,
+               "Time registering 10, 100, ... sensors up to -n (default "
+               "100000) phase by phase, then exit");
+
+  std::string histogram_json;
+  app.add_option("--histogram-json", histogram_json,
+                 "Write latency histograms as JSON to this file on exit");
+
+  std::string private_bus_daemon;
+  app.add_option("--private-bus", private_bus_daemon,
+                 "Run everything on a private bus of our own, started before "
+                 "and stopped after the run")
+      ->check(CLI::IsMember({"dbus-daemon", "dbus-broker"}));
+
+  std::string broker;
+  app.add_option("--broker", broker,
+                 "Name or PID of the bus broker process to account CPU, "
+                 "memory and context switches for (default: dbus-broker or "
+                 "dbus-daemon)");
+
+  size_t watchers = 0;
+  app.add_option("--watchers", watchers,
+                 "Number of watcher connections following the sensors of "
+                 "--service, each on its own match rules");
+  size_t matches = 1;
+  app.add_option("--matches", matches,
+                 "Number of match rules per watcher, each on a different "
+                 "sensor path")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  std::string match_style = "path";
+  app.add_option("--match-style", match_style,
+                 "What the watcher match rules select on: the sensor path "
+                 "namespace (one rule per watcher), the object path, the "
+                 "object path and Sensor.Value arg0, or the object path and "
+                 "an arg0namespace")
+      ->check(CLI::IsMember(
+          {"path-namespace", "path", "interface", "arg0namespace"}))
+      ->capture_default_str();
+
+  std::string results_json;
+  app.add_option("--json", results_json,
+                 "Write run metadata, per-interval samples and a summary as "
+                 "JSON to this file on exit");
+  std::string results_csv;
+  app.add_option("--csv", results_csv,
+                 "Write the per-interval samples as CSV to this file on "
+                 "exit, with metadata and summary in comment lines");
+
+  CLI::App *compare = app.add_subcommand(
+      "compare", "Compare two --json files and fail if the candidate "
+                 "regressed beyond the threshold");
+  std::string baseline;
+  compare->add_option("baseline", baseline, "Baseline --json file")
+      ->required()
+      ->check(CLI::ExistingFile);
+  std::string candidate;
+  compare->add_option("candidate", candidate, "Candidate --json file")
+      ->required()
+      ->check(CLI::ExistingFile);
+  double threshold_percent = 10.0;
+  compare->add_option("-t,--threshold", threshold_percent,
+                      "Percentage a metric may get worse by")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
   CLI11_PARSE(app, argc, argv);
 
-  if (number_of_sensors == 0 && watch_sensor_updates == false) {
+  if (compare->parsed()) {
+    return compare_results(baseline, candidate, threshold_percent);
+  }
+
+  if (!profile.empty()) {
+    std::optional<Workload> workload = load_workload(profile);
+    if (!workload) {
+      return -1;
+    }
+    number_of_sensors = workload->sensor_count();
+    shard_config.workload =
+        std::make_shared<const Workload>(std::move(*workload));
+  }
+
+  if (cache) {
+    watch_sensor_updates = true;
+  }
+  // Every Set would fail against read-only sensors
+  if (pipeline_method == "set") {
+    shard_config.writable = true;
+  }
+  if (number_of_sensors == 0 && watch_sensor_updates == false &&
+      read_method.empty() && pipeline_method.empty() && replay.empty() &&
+      watchers == 0 &&
+      shm_poll.empty() &&
+      !registration_benchmark &&
+      decode_benchmark == 0) {
     std::cout << "Nothing to do\n";
     app.exit(CLI::CallForHelp());
     return -1;
   }
 
+  if (!noise.empty()) {
+    std::optional<NoiseModel> model = load_noise_model(noise);
+    if (!model) {
+      return -1;
+    }
+    shard_config.noise = std::make_shared<const NoiseModel>(*model);
+  }
+
+  if (!shm.empty() && number_of_sensors == 0) {
+    std::cerr << "--shm needs sensors to publish, use -n or --profile\n";
+    return -1;
+  }
+
+  if (shard_config.batch_properties) {
+    shard_config.all_properties = true;
+  }
+  shard_config.update_interval =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(update_interval_seconds));
+  shard_config.end_to_end = end_to_end;
+  if (announce == "per-path") {
+    shard_config.announce = AnnounceMode::per_path;
+  } else if (announce == "name-owner") {
+    // The other connections' objects would be unreachable by name and never
+    // announced at all
+    if (number_of_connections > 1) {
+      std::cerr << "--announce name-owner needs -j 1, only the main "
+                   "connection claims the name\n";
+      return -1;
+    }
+    shard_config.announce = AnnounceMode::name_owner;
+  }
+
+  run_results.metadata = {
+      {"sensors", number_of_sensors},
+      {"connections", number_of_connections},
+      {"rate", update_rate},
+      {"interval_s", update_interval_seconds},
+      {"profile", profile},
+      {"watch", watch_sensor_updates},
+      {"end_to_end", end_to_end},
+      {"all_properties", shard_config.all_properties},
+      {"batch", shard_config.batch_properties},
+      {"thresholds", shard_config.thresholds},
+      {"announce", announce},
+      {"read", read_method},
+      {"read_concurrency", read_concurrency},
+      {"pipeline", pipeline_method},
+      {"windows", windows},
+      {"replay", replay},
+      {"replay_speed", replay_speed},
+      {"watchers", watchers},
+      {"matches", matches},
+      {"match_style", match_style},
+      {"cache", cache},
+      {"noise", noise},
+      {"deadband", shard_config.deadband.deadband},
+      {"hysteresis", shard_config.deadband.hysteresis},
+      {"shm", shm},
+      {"shm_poll", shm_poll},
+      {"shm_poll_interval_us", shm_poll_interval_us},
+      {"build_type", SENSOR_TESTER_BUILD_TYPE},
+  };
+
+  // Everything after this connects to the private bus, and it outlives all
+  // of those connections
+  std::unique_ptr<PrivateBus> private_bus;
+  if (!private_bus_daemon.empty()) {
+    private_bus = PrivateBus::launch(private_bus_daemon);
+    if (!private_bus) {
+      return -1;
+    }
+    private_bus->export_address();
+    std::cout << "Started a private " << private_bus_daemon << ", watch it "
+              << "with DBUS_SYSTEM_BUS_ADDRESS=" << private_bus->address()
+              << "\n";
+  }
+
+  std::optional<pid_t> broker_pid =
+      private_bus && broker.empty() ? private_bus->broker_pid()
+                                    : find_broker(broker);
+  if (!broker_pid && !broker.empty()) {
+    std::cerr << "Can't find broker process " << broker << "\n";
+    return -1;
+  }
+  if (!broker_pid) {
+    std::cout << "No dbus-broker or dbus-daemon found, only accounting the "
+                 "tester\n";
+  }
+
+  if (registration_benchmark) {
+    run_registration_benchmark(
+        io, shard_config, number_of_sensors > 0 ? number_of_sensors : 100000);
+    return 0;
+  }
+
+  if (decode_benchmark > 0) {
+    run_decode_benchmark(*open_connection(io), decode_benchmark);
+    return 0;
+  }
+
   std::shared_ptr<sdbusplus::asio::connection> connection =
       std::make_shared<sdbusplus::asio::connection>(io);
-  sdbusplus::asio::object_server objectServer(connection);
+  auto claim_name = [&]() {
+    try {
+      connection->request_name(service.c_str());
+    } catch (const sdbusplus::exception_t &e) {
+      std::cerr << "Can't claim " << service << ": " << e.what() << "\n";
+    }
+  };
+  bool claim_name_first = shard_config.announce != AnnounceMode::name_owner;
+  if (number_of_sensors > 0 && claim_name_first) {
+    claim_name();
+  }
+  // Subscribed before anything registers, so no announcement is missed
+  std::optional<AnnounceCounter> announce_counter;
+  if (measure_settle) {
+    announce_counter.emplace(open_connection(io));
+  }
+  std::chrono::steady_clock::time_point registration_start =
+      std::chrono::steady_clock::now();
+
+  // The first shard shares the main connection, so a single connection run
+  // behaves as it always has
+  auto shard_size = [&](size_t index) {
+    return number_of_sensors / number_of_connections +
+           (index < number_of_sensors % number_of_connections ? 1 : 0);
+  };
+  // Each shard offers its share of the total rate
+  auto shard_config_for = [&](size_t index) {
+    ShardConfig config = shard_config;
+    if (number_of_sensors > 0) {
+      config.update_rate = update_rate *
+                           static_cast<double>(shard_size(index)) /
+                           static_cast<double>(number_of_sensors);
+    }
+    return config;
+  };
+  if (!shm.empty()) {
+    shard_config.snapshot = ShmSnapshot::create(shm, number_of_sensors);
+    if (!shard_config.snapshot) {
+      return -1;
+    }
+  }
+  // The capture and the polled snapshot are opened before the shard threads
+  // start, returning with them still joinable would terminate
+  std::shared_ptr<sdbusplus::asio::connection> replay_connection;
+  std::optional<std::vector<CapturedMessage>> messages;
+  if (!replay.empty()) {
+    replay_connection = open_connection(io);
+    messages = load_capture(*replay_connection, replay);
+    if (!messages) {
+      return -1;
+    }
+  }
+  std::unique_ptr<ShmSnapshot> poll_snapshot;
+  if (!shm_poll.empty()) {
+    poll_snapshot = ShmSnapshot::open(shm_poll);
+    if (!poll_snapshot) {
+      return -1;
+    }
+  }
+  size_t first_sensor = 0;
+  SensorShard main_shard(connection, shard_config_for(0), first_sensor,
+                         shard_size(0));
+  shards.emplace_back(&main_shard);
+  first_sensor += shard_size(0);
+
+  std::vector<std::unique_ptr<ShardThread>> shard_threads;
+  for (size_t index = 1; index < number_of_connections; index++) {
+    auto shard_thread = std::make_unique<ShardThread>();
+    shard_thread->shard = std::make_unique<SensorShard>(
+        open_connection(shard_thread->io), shard_config_for(index),
+        first_sensor, shard_size(index));
+    first_sensor += shard_size(index);
+    shards.emplace_back(shard_thread->shard.get());
+    shard_threads.emplace_back(std::move(shard_thread));
+  }
+
+  RegistrationTimes registration;
+  for (SensorShard *shard : shards) {
+    registration.merge(shard->registration_times());
+    shard->announce();
+  }
+  if (number_of_sensors > 0 && !claim_name_first) {
+    claim_name();
+    connection->flush();
+  }
+  std::cout << "Done initializing in "
+            << std::chrono::duration_cast<std::chrono::duration<float>>(
+                   registration.total())
+                   .count()
+            << " seconds: " << registration.summary() << "\n";
+  std::cout << "Announced after "
+            << std::chrono::duration_cast<std::chrono::duration<float>>(
+                   std::chrono::steady_clock::now() - registration_start)
+                   .count()
+            << " seconds\n";
+
+  // The mapper only follows objects under well known names, which only the
+  // main connection claims
+  std::optional<SettleMonitor> settle_monitor;
+  if (measure_settle) {
+    settle_monitor.emplace(connection, main_shard.last_path(),
+                           registration_start);
+    settle_monitor->begin();
+    announce_counter->check(shard_config.announce, number_of_sensors,
+                            shard_config.thresholds ? 3 : 1);
+  }
+
+  main_shard.start();
+  for (auto &shard_thread : shard_threads) {
+    shard_thread->shard->start();
+    shard_thread->thread =
+        std::thread([&shard_io = shard_thread->io]() { shard_io.run(); });
+  }
+
+  // Reads go through their own connection, a call to our own name on the
+  // main connection would wait on itself
+  if (!read_method.empty()) {
+    ReadMethod method = ReadMethod::get;
+    if (read_method == "getall") {
+      method = ReadMethod::get_all;
+    } else if (read_method == "managed") {
+      method = ReadMethod::get_managed_objects;
+    }
+    read_client = std::make_unique<ReadClient>(open_connection(io), service,
+                                               method, read_concurrency);
+    read_client->start();
+  }
 
-  std::string name = "foobar";
-  sensorInterfaces.reserve(number_of_sensors);
-  for (size_t sensorIndex = 0; sensorIndex < number_of_sensors; sensorIndex++) {
-    sdbusplus::object_path path("/xyz/openbmc_project/sensors/temperature/");
-    path /= name + std::to_string(sensorIndex);
-    std::shared_ptr<sdbusplus::asio::dbus_interface> sensorInterface =
-        objectServer.add_interface(path.str,
-                                   "xyz.openbmc_project.Sensor.Value");
-    sensorInterface->register_property<std::string>(
-        "Unit", "xyz.openbmc_project.Sensor.Unit.DegreesC");
-    sensorInterface->register_property<double>("MaxValue", 100);
-    sensorInterface->register_property<double>("MinValue", -100);
-    sensorInterface->register_property<double>("Value", 42);
+  // The run ends when every window depth is done
+  if (!pipeline_method.empty()) {
+    PipelineMethod method = PipelineMethod::get;
+    if (pipeline_method == "set") {
+      method = PipelineMethod::set;
+    } else if (pipeline_method == "getall") {
+      method = PipelineMethod::get_all;
+    }
+    pipeline_client = std::make_unique<PipelineClient>(
+        open_connection(io), service, method, windows,
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(window_seconds)));
+    pipeline_client->start([]() { io.stop(); });
+  }
+
+  // Replayed messages come from a connection of their own, with a unique
+  // name of its own, and the run ends with the last reply
+  if (replay_connection) {
+    replayer = std::make_unique<Replayer>(replay_connection,
+                                          std::move(*messages), replay_speed);
+    replayer->start([]() { io.stop(); });
+  }
+
+  if (watchers > 0) {
+    MatchStyle style = MatchStyle::path;
+    if (match_style == "path-namespace") {
+      style = MatchStyle::path_namespace;
+    } else if (match_style == "interface") {
+      style = MatchStyle::interface;
+    } else if (match_style == "arg0namespace") {
+      style = MatchStyle::arg0_namespace;
+    }
+    watcher_pool =
+        std::make_unique<WatcherPool>(watchers, matches, style, end_to_end);
+    watcher_pool->start(service);
+  }
 
-    sensorInterface->initialize();
-    sensorInterfaces.emplace_back(sensorInterface);
+  if (poll_snapshot) {
+    shm_poller = std::make_unique<ShmPoller>(
+        std::move(poll_snapshot),
+        std::chrono::microseconds(shm_poll_interval_us));
+    shm_poller->start();
   }
 
-  std::cout << "Done initializing\n";
+  if (soak_mode) {
+    soak = std::make_unique<SoakRecorder>(
+        std::chrono::seconds(soak_bucket_seconds), soak_buckets,
+        std::chrono::seconds(soak_warmup_seconds));
+    keep_samples = !results_json.empty() || !results_csv.empty();
+  }
+  boost::asio::steady_timer duration_timer(io);
+  if (duration_seconds > 0.0) {
+    duration_timer.expires_after(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(duration_seconds)));
+    duration_timer.async_wait([](const boost::system::error_code &error) {
+      if (!error) {
+        io.stop();
+      }
+    });
+  }
 
+  report_start = std::chrono::steady_clock::now();
+  tester_resources.emplace();
+  if (broker_pid) {
+    broker_resources.emplace(*broker_pid);
+  }
   boost::asio::steady_timer timer(io);
-  timer.expires_from_now(std::chrono::seconds(update_interval_seconds));
-  timer.async_wait(std::bind_front(on_loop, &timer));
+  timer.expires_from_now(report_interval);
+  timer.async_wait(std::bind_front(on_report, &timer));
   std::optional<sdbusplus::bus::match_t> match;
   if (watch_sensor_updates) {
     std::string expr = "type='signal',member='PropertiesChanged',path_"
                        "namespace='/xyz/openbmc_project/sensors'";
 
+    bool read_decoder = decoder == "read";
     match.emplace(
         static_cast<sdbusplus::bus_t &>(*connection), expr,
-        [](sdbusplus::message_t &message) {
-          std::string objectName;
-          std::vector<std::pair<std::string, std::variant<double>>> result;
-          try {
-            message.read(objectName, result);
-          } catch (const sdbusplus::exception_t &) {
+        [read_decoder](sdbusplus::message_t &message) {
+          std::chrono::steady_clock::time_point start =
+              std::chrono::steady_clock::now();
+          uint64_t allocations = thread_allocations();
+          double value = 0.0;
+          int r = read_decoder ? read_sensor_value(message, &value)
+                               : decode_sensor_value(message.get(), &value);
+          if (r < 0) {
             std::cerr << "Error reading match data\n";
             return;
           }
-          for (auto &property : result) {
-            if (property.first == "Value") {
-              reads++;
+          if (r > 0) {
+            reads++;
+            if (sensor_cache) {
+              sensor_cache->update(sd_bus_message_get_path(message.get()),
+                                   value);
+            }
+            if (end_to_end) {
+              probe_tracker.record(sd_bus_message_get_path(message.get()),
+                                   value);
             }
           }
+          handler_allocations += thread_allocations() - allocations;
+          signal_latency.record(std::chrono::steady_clock::now() - start);
         });
   }
 
+  // The cache has a connection of its own, so its name and objects are
+  // apart from the sensors it caches
+  if (cache) {
+    sensor_cache = std::make_unique<SensorCache>(open_connection(io));
+    sensor_cache->start(cache_service, service);
+  }
+
+  boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+  signals.async_wait(
+      [](const boost::system::error_code &, int) { io.stop(); });
+
   io.run();
 
-  return 0;
+  for (auto &shard_thread : shard_threads) {
+    shard_thread->io.stop();
+    shard_thread->thread.join();
+  }
+
+  nlohmann::json latency = latency_json();
+  if (!histogram_json.empty() &&
+      !write_histogram_json(histogram_json, latency)) {
+    return -1;
+  }
+  nlohmann::json summary = run_results.summary(latency);
+  uint64_t events = summary["updates"].get<uint64_t>() > 0
+                        ? summary["updates"].get<uint64_t>()
+                        : summary["reads"].get<uint64_t>();
+  if (std::optional<ResourceInterval> usage = tester_resources->total()) {
+    summary["tester"] = usage->to_json(events);
+  }
+  if (broker_resources) {
+    if (std::optional<ResourceInterval> usage = broker_resources->total()) {
+      summary["broker"] = usage->to_json(events);
+      uint64_t signals = summary["signals"].get<uint64_t>();
+      uint64_t deliveries = summary["deliveries"].get<uint64_t>();
+      if (signals > 0) {
+        summary["broker"]["cpu_ns_per_signal"] =
+            static_cast<uint64_t>(usage->cpu.count()) / signals;
+      }
+      if (deliveries > 0) {
+        summary["broker"]["cpu_ns_per_delivery"] =
+            static_cast<uint64_t>(usage->cpu.count()) / deliveries;
+      }
+    }
+  }
+  if (replayer) {
+    replay_stats_total.merge(replayer->take_stats());
+    summary["replay"] = replay_stats_total.to_json();
+  }
+  if (pipeline_client) {
+    pipeline_client->print();
+    summary["pipeline"] = pipeline_client->to_json();
+  }
+  bool soak_passed = true;
+  if (soak) {
+    soak_passed = soak->evaluate(soak_thresholds);
+    summary["soak"] = soak->to_json();
+  }
+  watcher_pool.reset();
+  sensor_cache.reset();
+  shm_poller.reset();
+  if (!results_json.empty() && !run_results.write_json(results_json, summary)) {
+    return -1;
+  }
+  if (!results_csv.empty() && !run_results.write_csv(results_csv, summary)) {
+    return -1;
+  }
+
+  return soak_passed ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "pipeline_client.hpp"
+
+#include "read_client.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <utility>
+#include <variant>
+
+double PipelineResult::calls_per_second() const {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0.0 ? static_cast<double>(replies) / seconds : 0.0;
+}
+
+PipelineClient::PipelineClient(
+    std::shared_ptr<sdbusplus::asio::connection> connection,
+    const std::string &service, PipelineMethod method,
+    std::vector<size_t> windows, std::chrono::steady_clock::duration duration)
+    : connection(connection), service(service), method(method),
+      windows(std::move(windows)), duration(duration),
+      drained(connection->get_io_context()) {}
+
+const char *PipelineClient::method_name() const {
+  switch (method) {
+  case PipelineMethod::get:
+    return "Get";
+  case PipelineMethod::set:
+    return "Set";
+  case PipelineMethod::get_all:
+    return "GetAll";
+  }
+  return "";
+}
+
+void PipelineClient::start(std::function<void()> done) {
+  boost::asio::co_spawn(connection->get_io_context(), sweep(),
+                        [done](std::exception_ptr) { done(); });
+}
+
+sdbusplus::message_t PipelineClient::new_call(const std::string &path) {
+  sdbusplus::message_t call = connection->new_method_call(
+      service.c_str(), path.c_str(), "org.freedesktop.DBus.Properties",
+      method_name());
+  switch (method) {
+  case PipelineMethod::get:
+    call.append("xyz.openbmc_project.Sensor.Value", "Value");
+    break;
+  case PipelineMethod::set:
+    // A new value every call, so every Set changes the property
+    call.append("xyz.openbmc_project.Sensor.Value", "Value",
+                std::variant<double>(next_value));
+    next_value += 1.0;
+    break;
+  case PipelineMethod::get_all:
+    call.append("xyz.openbmc_project.Sensor.Value");
+    break;
+  }
+  return call;
+}
+
+boost::asio::awaitable<void> PipelineClient::sweep() {
+  sdbusplus::message_t list =
+      connection->new_method_call(service.c_str(), "/",
+                                  "org.freedesktop.DBus.ObjectManager",
+                                  "GetManagedObjects");
+  std::optional<std::vector<std::string>> discovered;
+  try {
+    sdbusplus::message_t reply =
+        co_await connection->async_send(list, boost::asio::use_awaitable);
+    discovered = managed_object_paths(reply);
+  } catch (const boost::system::system_error &e) {
+    std::cerr << "Can't list objects of " << service << ": " << e.what()
+              << "\n";
+    co_return;
+  }
+  if (!discovered || discovered->empty()) {
+    std::cerr << service << " has no objects to call\n";
+    co_return;
+  }
+  paths = std::move(*discovered);
+  std::cout << "Calling " << method_name() << " on " << paths.size()
+            << " objects of " << service << "\n";
+
+  // The callers hold on to their result, which must not move under them
+  results.reserve(windows.size());
+  for (size_t window : windows) {
+    PipelineResult &result = results.emplace_back();
+    result.window = window;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    active = window;
+    for (size_t index = 0; index < window; index++) {
+      boost::asio::co_spawn(connection->get_io_context(),
+                            caller(result, start + duration,
+                                   index % paths.size()),
+                            boost::asio::detached);
+    }
+    drained.expires_at(std::chrono::steady_clock::time_point::max());
+    try {
+      co_await drained.async_wait(boost::asio::use_awaitable);
+    } catch (const boost::system::system_error &) {
+      // Cancelled by the last caller
+    }
+    result.elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "window " << window << ": "
+              << static_cast<uint64_t>(result.calls_per_second())
+              << " calls/s, " << result.errors
+              << " errors, latency: " << result.latency.summary() << "\n";
+  }
+}
+
+boost::asio::awaitable<void>
+PipelineClient::caller(PipelineResult &result,
+                       std::chrono::steady_clock::time_point deadline,
+                       size_t next_path) {
+  while (std::chrono::steady_clock::now() < deadline) {
+    sdbusplus::message_t call = new_call(paths[next_path]);
+    next_path = (next_path + 1) % paths.size();
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    try {
+      sdbusplus::message_t reply =
+          co_await connection->async_send(call, boost::asio::use_awaitable);
+      if (reply.is_method_error()) {
+        result.errors++;
+      } else {
+        result.replies++;
+      }
+    } catch (const boost::system::system_error &) {
+      result.errors++;
+    }
+    result.latency.record(std::chrono::steady_clock::now() - start);
+  }
+  if (--active == 0) {
+    drained.cancel();
+  }
+}
+
+void PipelineClient::print() const {
+  if (results.empty()) {
+    return;
+  }
+  double serial = results.front().calls_per_second();
+  std::ios_base::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::left << std::setw(10) << "window" << std::right
+            << std::setw(14) << "calls/s" << std::setw(10) << "speedup"
+            << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+            << std::setw(10) << "errors" << "\n";
+  for (const PipelineResult &result : results) {
+    auto micros = [](std::chrono::nanoseconds value) {
+      return std::chrono::duration<double, std::micro>(value).count();
+    };
+    std::cout << std::left << std::setw(10) << result.window << std::right
+              << std::fixed << std::setprecision(0) << std::setw(14)
+              << result.calls_per_second() << std::setprecision(2)
+              << std::setw(10)
+              << (serial > 0.0 ? result.calls_per_second() / serial : 0.0)
+              << std::setprecision(1) << std::setw(12)
+              << micros(result.latency.percentile(50.0)) << std::setw(12)
+              << micros(result.latency.percentile(99.0)) << std::setw(10)
+              << result.errors << "\n";
+  }
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+}
+
+nlohmann::json PipelineClient::to_json() const {
+  nlohmann::json::array_t windows_json;
+  for (const PipelineResult &result : results) {
+    nlohmann::json entry = result.latency.to_json();
+    entry["window"] = result.window;
+    entry["replies"] = result.replies;
+    entry["errors"] = result.errors;
+    entry["calls_per_second"] = result.calls_per_second();
+    windows_json.emplace_back(std::move(entry));
+  }
+  return {
+      {"method", method_name()},
+      {"objects", paths.size()},
+      {"windows", windows_json},
+  };
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <sdbusplus/asio/connection.hpp>
+#include <string>
+#include <vector>
+
+enum class PipelineMethod {
+  get,
+  set,
+  get_all,
+};
+
+// Calls made with one window depth
+struct PipelineResult {
+  size_t window = 0;
+  size_t replies = 0;
+  size_t errors = 0;
+  std::chrono::steady_clock::duration elapsed{};
+  Histogram latency;
+
+  double calls_per_second() const;
+};
+
+// Issues Get, Set or GetAll calls against the sensor tree of a service as
+// C++20 coroutines on the io_context.  A window of N is N coroutines, each
+// awaiting the reply to its call before making the next, so N calls are in
+// flight.  Every window depth runs for the same time, one after another,
+// which shows how much of the round trip pipelining hides compared to the
+// serial calls of a window of 1.
+class PipelineClient {
+public:
+  PipelineClient(std::shared_ptr<sdbusplus::asio::connection> connection,
+                 const std::string &service, PipelineMethod method,
+                 std::vector<size_t> windows,
+                 std::chrono::steady_clock::duration duration);
+
+  // Discovers the objects and runs every window depth, then calls done
+  void start(std::function<void()> done);
+  const char *method_name() const;
+  // Calls per second and latency against window depth
+  void print() const;
+  nlohmann::json to_json() const;
+
+private:
+  boost::asio::awaitable<void> sweep();
+  boost::asio::awaitable<void> caller(PipelineResult &result,
+                                      std::chrono::steady_clock::time_point
+                                          deadline,
+                                      size_t next_path);
+  sdbusplus::message_t new_call(const std::string &path);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  std::string service;
+  PipelineMethod method;
+  std::vector<size_t> windows;
+  std::chrono::steady_clock::duration duration;
+
+  std::vector<std::string> paths;
+  std::vector<PipelineResult> results;
+  // Callers still running in the current window, the last one to finish
+  // cancels the wait on drained
+  size_t active = 0;
+  boost::asio::steady_timer drained;
+  double next_value = 0.0;
+};
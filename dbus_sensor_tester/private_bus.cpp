@@ -0,0 +1,242 @@
+#include "private_bus.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+// The first file descriptor passed in socket activation, SD_LISTEN_FDS_START
+static constexpr int listen_fds_start = 3;
+
+// The broker gets this long to come up before we give up on it
+static constexpr std::chrono::seconds startup_timeout(5);
+
+// Everyone may own and talk to anything, and the limits are raised well
+// past what a benchmark run needs, so the bus measures routing cost and not
+// policy.  dbus-broker takes its socket from us and ignores <listen>.
+static constexpr const char *config_template = R"(<!DOCTYPE busconfig PUBLIC
+ "-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN"
+ "http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd">
+<busconfig>
+  <type>system</type>
+  <listen>unix:path=@SOCKET@</listen>
+  <auth>EXTERNAL</auth>
+  <policy context="default">
+    <allow user="*"/>
+    <allow own="*"/>
+    <allow send_destination="*" eavesdrop="true"/>
+    <allow receive_sender="*"/>
+    <allow eavesdrop="true"/>
+  </policy>
+  <limit name="max_incoming_bytes">1000000000</limit>
+  <limit name="max_outgoing_bytes">1000000000</limit>
+  <limit name="max_connections_per_user">10000</limit>
+  <limit name="max_replies_per_connection">1000000</limit>
+  <limit name="max_match_rules_per_connection">1000000</limit>
+  <limit name="max_names_per_connection">10000</limit>
+</busconfig>
+)";
+
+std::unique_ptr<PrivateBus> PrivateBus::launch(const std::string &daemon) {
+  std::unique_ptr<PrivateBus> bus(new PrivateBus());
+
+  const char *tmpdir = std::getenv("TMPDIR");
+  std::string directory_template =
+      std::string(tmpdir != nullptr ? tmpdir : "/tmp") +
+      "/sensortest-bus-XXXXXX";
+  if (mkdtemp(directory_template.data()) == nullptr) {
+    std::cerr << "Can't create a directory for the private bus: "
+              << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+  bus->directory = directory_template;
+  bus->socket_path = bus->directory + "/system_bus_socket";
+  if (!bus->write_config()) {
+    return nullptr;
+  }
+
+  bool started = daemon == "dbus-broker" ? bus->start_dbus_broker()
+                                         : bus->start_dbus_daemon();
+  if (!started) {
+    return nullptr;
+  }
+  return bus;
+}
+
+PrivateBus::~PrivateBus() {
+  if (pid > 0) {
+    // The bus runs in its own process group, which also holds the broker
+    // dbus-broker-launch forks
+    kill(-pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+  }
+  if (!directory.empty()) {
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+  }
+}
+
+void PrivateBus::export_address() const {
+  // sd_bus_default and sd_bus_open both follow DBUS_STARTER_BUS_TYPE to the
+  // system bus, and sd_bus_open_system follows DBUS_SYSTEM_BUS_ADDRESS
+  setenv("DBUS_SYSTEM_BUS_ADDRESS", bus_address.c_str(), 1);
+  setenv("DBUS_STARTER_BUS_TYPE", "system", 1);
+  unsetenv("DBUS_STARTER_ADDRESS");
+}
+
+bool PrivateBus::write_config() const {
+  std::string config = config_template;
+  config.replace(config.find("@SOCKET@"), std::strlen("@SOCKET@"),
+                 socket_path);
+  std::ofstream file(directory + "/bus.conf");
+  file << config;
+  if (!file) {
+    std::cerr << "Can't write " << directory << "/bus.conf\n";
+    return false;
+  }
+  return true;
+}
+
+// dbus-daemon writes its address to a pipe once it is listening, so there
+// is nothing to poll
+bool PrivateBus::start_dbus_daemon() {
+  int address_pipe[2];
+  if (pipe(address_pipe) != 0) {
+    std::cerr << "Can't create a pipe: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  std::string config_option = "--config-file=" + directory + "/bus.conf";
+  std::string address_option =
+      "--print-address=" + std::to_string(address_pipe[1]);
+
+  pid = fork();
+  if (pid == 0) {
+    setpgid(0, 0);
+    close(address_pipe[0]);
+    execlp("dbus-daemon", "dbus-daemon", "--nofork", config_option.c_str(),
+           address_option.c_str(), nullptr);
+    std::cerr << "Can't run dbus-daemon: " << std::strerror(errno) << "\n";
+    _exit(127);
+  }
+  close(address_pipe[1]);
+  if (pid < 0) {
+    std::cerr << "Can't fork: " << std::strerror(errno) << "\n";
+    close(address_pipe[0]);
+    return false;
+  }
+
+  char buffer[512];
+  ssize_t length = 0;
+  while (length < static_cast<ssize_t>(sizeof(buffer))) {
+    ssize_t r = read(address_pipe[0], buffer + length,
+                     sizeof(buffer) - static_cast<size_t>(length));
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    length += r;
+    if (buffer[length - 1] == '\n') {
+      break;
+    }
+  }
+  close(address_pipe[0]);
+
+  bus_address.assign(buffer, static_cast<size_t>(length));
+  while (!bus_address.empty() && bus_address.back() == '\n') {
+    bus_address.pop_back();
+  }
+  if (bus_address.empty()) {
+    std::cerr << "dbus-daemon didn't start\n";
+    return false;
+  }
+  return true;
+}
+
+// dbus-broker-launch expects to be socket activated, so we listen on the
+// socket ourselves and hand it over the way systemd would.  Clients can
+// connect as soon as the socket listens, the broker picks them up from the
+// backlog once it is running.
+bool PrivateBus::start_dbus_broker() {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (fd < 0 || socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Can't create the private bus socket\n";
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  socket_path.copy(address.sun_path, socket_path.size());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    std::cerr << "Can't listen on " << socket_path << ": "
+              << std::strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+  std::string config_file = directory + "/bus.conf";
+
+  pid = fork();
+  if (pid == 0) {
+    setpgid(0, 0);
+    if (fd == listen_fds_start) {
+      fcntl(fd, F_SETFD, 0);
+    } else {
+      dup2(fd, listen_fds_start);
+    }
+    setenv("LISTEN_PID", std::to_string(getpid()).c_str(), 1);
+    setenv("LISTEN_FDS", "1", 1);
+    execlp("dbus-broker-launch", "dbus-broker-launch", "--scope", "user",
+           "--config-file", config_file.c_str(), nullptr);
+    std::cerr << "Can't run dbus-broker-launch: " << std::strerror(errno)
+              << "\n";
+    _exit(127);
+  }
+  close(fd);
+  if (pid < 0) {
+    std::cerr << "Can't fork: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  bus_address = "unix:path=" + socket_path;
+
+  // The launcher is ready once it has forked the broker
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + startup_timeout;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (waitpid(pid, nullptr, WNOHANG) == pid) {
+      std::cerr << "dbus-broker-launch exited\n";
+      pid = -1;
+      return false;
+    }
+    if (broker_pid() != pid) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::cerr << "dbus-broker didn't start\n";
+  return false;
+}
+
+pid_t PrivateBus::broker_pid() const {
+  std::string task = std::to_string(pid);
+  std::ifstream children("/proc/" + task + "/task/" + task + "/children");
+  pid_t child = 0;
+  if (children >> child) {
+    return child;
+  }
+  return pid;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+
+// A dbus-daemon or dbus-broker instance of our own, listening on a socket
+// in a temporary directory, so a benchmark doesn't share the bus with
+// whatever else is running.  The bus is stopped and the directory removed
+// when this goes away.
+class PrivateBus {
+public:
+  // daemon is "dbus-daemon" or "dbus-broker".  Returns null if the bus
+  // can't be started.
+  static std::unique_ptr<PrivateBus> launch(const std::string &daemon);
+
+  PrivateBus(const PrivateBus &) = delete;
+  PrivateBus &operator=(const PrivateBus &) = delete;
+  ~PrivateBus();
+
+  // Points the system bus, and the default bus, of this process and of any
+  // process started from it at the private bus
+  void export_address() const;
+
+  const std::string &address() const { return bus_address; }
+  // The process routing the messages, for resource accounting
+  pid_t broker_pid() const;
+
+private:
+  PrivateBus() = default;
+
+  bool write_config() const;
+  bool start_dbus_daemon();
+  bool start_dbus_broker();
+
+  std::string directory;
+  std::string socket_path;
+  std::string bus_address;
+  pid_t pid = -1;
+};
@@ -0,0 +1,101 @@
+#include "probe.hpp"
+
+#include <iostream>
+
+static constexpr uint64_t time_mask = (uint64_t{1} << Probe::time_bits) - 1;
+static constexpr uint32_t sequence_mask =
+    (uint32_t{1} << Probe::sequence_bits) - 1;
+
+static uint64_t steady_clock_us() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+Probe Probe::now(uint64_t sequence) {
+  Probe probe;
+  probe.sequence = static_cast<uint32_t>(sequence) & sequence_mask;
+  probe.send_time_us = static_cast<uint32_t>(steady_clock_us() & time_mask);
+  return probe;
+}
+
+Probe Probe::decode(double value) {
+  uint64_t raw = value < 0 ? 0 : static_cast<uint64_t>(value);
+  Probe probe;
+  probe.send_time_us = static_cast<uint32_t>(raw & time_mask);
+  probe.sequence = static_cast<uint32_t>(raw >> time_bits) & sequence_mask;
+  return probe;
+}
+
+double Probe::encode() const {
+  uint64_t raw = (uint64_t{sequence} << time_bits) | send_time_us;
+  return static_cast<double>(raw);
+}
+
+std::chrono::microseconds Probe::age() const {
+  uint32_t now = static_cast<uint32_t>(steady_clock_us() & time_mask);
+  return std::chrono::microseconds(static_cast<uint32_t>(now - send_time_us));
+}
+
+void ProbeTracker::record(std::string_view path, double value) {
+  Probe probe = Probe::decode(value);
+  latency.record(probe.age());
+  received++;
+
+  auto state = paths.find(path);
+  if (state == paths.end()) {
+    paths.emplace(path, PathState{probe.sequence});
+    return;
+  }
+  uint32_t gap = (probe.sequence - state->second.last_sequence) & sequence_mask;
+  if (gap == 0) {
+    duplicated++;
+    return;
+  }
+  // Anything more than half the sequence space ahead is really behind
+  if (gap > (sequence_mask >> 1)) {
+    uint32_t behind = (state->second.last_sequence - probe.sequence) &
+                      sequence_mask;
+    if (behind >= window) {
+      reordered++;
+      return;
+    }
+    uint64_t bit = uint64_t{1} << behind;
+    if ((state->second.seen & bit) != 0) {
+      duplicated++;
+      return;
+    }
+    // Its gap was counted as dropped when the newer probe arrived
+    state->second.seen |= bit;
+    dropped--;
+    reordered++;
+    return;
+  }
+  dropped += gap - 1;
+  state->second.last_sequence = probe.sequence;
+  state->second.seen = gap < window ? (state->second.seen << gap) | 1 : 1;
+}
+
+void ProbeTracker::print_interval() {
+  if (received == 0) {
+    return;
+  }
+  std::cout << "end to end latency: " << latency.summary() << "\n";
+  std::cout << "probes so far: received " << received << ", dropped "
+            << dropped << ", reordered " << reordered << ", duplicated "
+            << duplicated << "\n";
+  latency_total.merge(latency);
+  latency.reset();
+}
+
+nlohmann::json ProbeTracker::to_json() {
+  latency_total.merge(latency);
+  latency.reset();
+  nlohmann::json result = latency_total.to_json();
+  result["received"] = received;
+  result["dropped"] = dropped;
+  result["reordered"] = reordered;
+  result["duplicated"] = duplicated;
+  return result;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// In end to end mode the producer publishes probes instead of sawtooth
+// values.  A probe packs a sequence number, the sensor's count of values
+// published so far, and the steady_clock send time into the 53 bits a
+// double can hold exactly: the low 32 bits are the send time in
+// microseconds (wrapping every ~71 minutes), the high 21 bits are the
+// sequence number (wrapping every ~2M values of that sensor).  steady_clock is
+// CLOCK_MONOTONIC, which is shared between the producer and the watcher
+// processes on the same machine.
+struct Probe {
+  static constexpr unsigned time_bits = 32;
+  static constexpr unsigned sequence_bits = 21;
+
+  uint32_t sequence = 0;
+  uint32_t send_time_us = 0;
+
+  static Probe now(uint64_t sequence);
+  static Probe decode(double value);
+  double encode() const;
+
+  // Microseconds between the send time and now, modulo the time wrap
+  std::chrono::microseconds age() const;
+};
+
+// Lets the watcher look paths up without building a std::string
+struct PathHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view path) const {
+    return std::hash<std::string_view>()(path);
+  }
+};
+
+// Tracks the last probe seen on every object path to classify arriving
+// probes as in order, dropped, reordered or duplicated.  A probe that
+// arrives late inside the window of recent sequences moves from dropped to
+// reordered; one older than the window, the last 64 values of its sensor, is
+// only counted as reordered.
+class ProbeTracker {
+public:
+  // Only allocates the first time a path is seen
+  void record(std::string_view path, double value);
+  void print_interval();
+  nlohmann::json to_json();
+
+private:
+  struct PathState {
+    uint32_t last_sequence = 0;
+    // Bit n is set once last_sequence - n has been seen
+    uint64_t seen = 1;
+  };
+  static constexpr uint32_t window = 64;
+
+  std::unordered_map<std::string, PathState, PathHash, std::equal_to<>>
+      paths;
+
+  Histogram latency;
+  Histogram latency_total;
+  uint64_t received = 0;
+  uint64_t dropped = 0;
+  uint64_t reordered = 0;
+  uint64_t duplicated = 0;
+};
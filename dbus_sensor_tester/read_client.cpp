@@ -0,0 +1,245 @@
+#include "read_client.hpp"
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <systemd/sd-bus.h>
+#include <utility>
+
+void ReadStats::merge(const ReadStats &other) {
+  replies += other.replies;
+  errors += other.errors;
+  reply_bytes += other.reply_bytes;
+  latency.merge(other.latency);
+}
+
+ReadClient::ReadClient(std::shared_ptr<sdbusplus::asio::connection> connection,
+                       const std::string &service, ReadMethod method,
+                       size_t concurrency)
+    : connection(connection), service(service), method(method),
+      concurrency(concurrency) {}
+
+const char *ReadClient::method_name() const {
+  switch (method) {
+  case ReadMethod::get:
+    return "Get";
+  case ReadMethod::get_all:
+    return "GetAll";
+  case ReadMethod::get_managed_objects:
+    return "GetManagedObjects";
+  }
+  return "";
+}
+
+void ReadClient::start() {
+  sdbusplus::message_t discover =
+      connection->new_method_call(service.c_str(), "/",
+                                  "org.freedesktop.DBus.ObjectManager",
+                                  "GetManagedObjects");
+  connection->async_send(discover,
+                         std::bind_front(&ReadClient::on_discovered, this));
+}
+
+void ReadClient::on_discovered(const boost::system::error_code &error,
+                               sdbusplus::message_t reply) {
+  if (error) {
+    std::cerr << "Can't list objects of " << service << ": "
+              << error.message() << "\n";
+    return;
+  }
+  std::optional<std::vector<std::string>> discovered =
+      managed_object_paths(reply);
+  if (!discovered) {
+    std::cerr << "Unexpected GetManagedObjects reply\n";
+    return;
+  }
+  paths = std::move(*discovered);
+
+  if (paths.empty()) {
+    std::cerr << service << " has no objects to read\n";
+    return;
+  }
+  std::cout << "Reading " << paths.size() << " objects of " << service
+            << " with " << method_name() << ", " << concurrency
+            << " calls in flight\n";
+  for (size_t index = 0; index < concurrency; index++) {
+    issue();
+  }
+}
+
+void ReadClient::issue() {
+  const std::string &path = paths[next_path];
+  next_path = (next_path + 1) % paths.size();
+
+  sdbusplus::message_t call;
+  switch (method) {
+  case ReadMethod::get:
+    call = connection->new_method_call(service.c_str(), path.c_str(),
+                                       "org.freedesktop.DBus.Properties",
+                                       "Get");
+    call.append("xyz.openbmc_project.Sensor.Value", "Value");
+    break;
+  case ReadMethod::get_all:
+    call = connection->new_method_call(service.c_str(), path.c_str(),
+                                       "org.freedesktop.DBus.Properties",
+                                       "GetAll");
+    call.append("xyz.openbmc_project.Sensor.Value");
+    break;
+  case ReadMethod::get_managed_objects:
+    call = connection->new_method_call(service.c_str(), "/",
+                                       "org.freedesktop.DBus.ObjectManager",
+                                       "GetManagedObjects");
+    break;
+  }
+  connection->async_send(call,
+                         std::bind_front(&ReadClient::on_reply, this,
+                                         std::chrono::steady_clock::now()));
+}
+
+void ReadClient::on_reply(std::chrono::steady_clock::time_point start,
+                          const boost::system::error_code &error,
+                          sdbusplus::message_t reply) {
+  stats.latency.record(std::chrono::steady_clock::now() - start);
+  if (error || reply.is_method_error()) {
+    stats.errors++;
+  } else {
+    stats.replies++;
+    stats.reply_bytes += marshalled_body_size(reply.get());
+  }
+  issue();
+}
+
+// a{oa{sa{sv}}}, only the object paths are of interest
+std::optional<std::vector<std::string>>
+managed_object_paths(sdbusplus::message_t &reply) {
+  sd_bus_message *m = reply.get();
+  if (sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{oa{sa{sv}}}") <
+      0) {
+    return std::nullopt;
+  }
+  std::vector<std::string> paths;
+  while (sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                        "oa{sa{sv}}") > 0) {
+    const char *path = nullptr;
+    if (sd_bus_message_read_basic(m, SD_BUS_TYPE_OBJECT_PATH, &path) < 0 ||
+        sd_bus_message_skip(m, "a{sa{sv}}") < 0) {
+      return std::nullopt;
+    }
+    paths.emplace_back(path);
+    sd_bus_message_exit_container(m);
+  }
+  sd_bus_message_exit_container(m);
+  return paths;
+}
+
+ReadStats ReadClient::take_stats() { return std::exchange(stats, ReadStats()); }
+
+static size_t align_to(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+static size_t alignment_of(char type) {
+  switch (type) {
+  case 'y':
+  case 'g':
+  case 'v':
+    return 1;
+  case 'n':
+  case 'q':
+    return 2;
+  case 'b':
+  case 'i':
+  case 'u':
+  case 'h':
+  case 's':
+  case 'o':
+  case 'a':
+    return 4;
+  default:
+    // x, t, d, structs and dict entries
+    return 8;
+  }
+}
+
+static size_t basic_size(char type) {
+  switch (type) {
+  case 'y':
+    return 1;
+  case 'n':
+  case 'q':
+    return 2;
+  case 'x':
+  case 't':
+  case 'd':
+    return 8;
+  default:
+    return 4;
+  }
+}
+
+// Adds the size of the remaining items of the current container to offset
+static int walk(sd_bus_message *m, size_t &offset) {
+  for (;;) {
+    char type = 0;
+    const char *contents = nullptr;
+    int r = sd_bus_message_peek_type(m, &type, &contents);
+    if (r <= 0) {
+      return r;
+    }
+    offset = align_to(offset, alignment_of(type));
+    switch (type) {
+    case SD_BUS_TYPE_ARRAY:
+    case SD_BUS_TYPE_VARIANT:
+    case SD_BUS_TYPE_STRUCT:
+    case SD_BUS_TYPE_DICT_ENTRY:
+      if (type == SD_BUS_TYPE_ARRAY) {
+        // Length, then padding to the first element even when empty
+        offset = align_to(offset + 4, alignment_of(contents[0]));
+      } else if (type == SD_BUS_TYPE_VARIANT) {
+        offset += std::strlen(contents) + 2;
+      }
+      r = sd_bus_message_enter_container(m, type, contents);
+      if (r < 0) {
+        return r;
+      }
+      r = walk(m, offset);
+      if (r < 0) {
+        return r;
+      }
+      r = sd_bus_message_exit_container(m);
+      if (r < 0) {
+        return r;
+      }
+      break;
+    case 's':
+    case 'o':
+    case 'g': {
+      const char *string = nullptr;
+      r = sd_bus_message_read_basic(m, type, &string);
+      if (r < 0) {
+        return r;
+      }
+      offset += (type == 'g' ? 1 : 4) + std::strlen(string) + 1;
+      break;
+    }
+    default: {
+      uint64_t storage = 0;
+      r = sd_bus_message_read_basic(m, type, &storage);
+      if (r < 0) {
+        return r;
+      }
+      offset += basic_size(type);
+      break;
+    }
+    }
+  }
+}
+
+size_t marshalled_body_size(sd_bus_message *message) {
+  size_t size = 0;
+  sd_bus_message_rewind(message, 1);
+  if (walk(message, size) < 0) {
+    return 0;
+  }
+  return size;
+}
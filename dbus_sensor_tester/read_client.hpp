@@ -0,0 +1,66 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <sdbusplus/asio/connection.hpp>
+#include <string>
+#include <vector>
+
+enum class ReadMethod {
+  get,
+  get_all,
+  get_managed_objects,
+};
+
+struct ReadStats {
+  size_t replies = 0;
+  size_t errors = 0;
+  // dbus1 marshalled body size of all replies
+  uint64_t reply_bytes = 0;
+  Histogram latency;
+
+  void merge(const ReadStats &other);
+};
+
+// Issues Get, GetAll or GetManagedObjects calls against the sensor tree of a
+// service, keeping a fixed number of calls in flight.  The object paths are
+// discovered with one GetManagedObjects call at start.
+class ReadClient {
+public:
+  ReadClient(std::shared_ptr<sdbusplus::asio::connection> connection,
+             const std::string &service, ReadMethod method,
+             size_t concurrency);
+
+  void start();
+  ReadStats take_stats();
+  size_t object_count() const { return paths.size(); }
+  const char *method_name() const;
+
+private:
+  void on_discovered(const boost::system::error_code &error,
+                     sdbusplus::message_t reply);
+  void issue();
+  void on_reply(std::chrono::steady_clock::time_point start,
+                const boost::system::error_code &error,
+                sdbusplus::message_t reply);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  std::string service;
+  ReadMethod method;
+  size_t concurrency;
+
+  std::vector<std::string> paths;
+  size_t next_path = 0;
+  ReadStats stats;
+};
+
+// Object paths of a GetManagedObjects reply, nullopt if it is malformed
+std::optional<std::vector<std::string>>
+managed_object_paths(sdbusplus::message_t &reply);
+
+// Size of the message body as marshalled on the wire, which sd-bus does not
+// expose, computed by walking the message.  Rewinds the message.
+size_t marshalled_body_size(sd_bus_message *message);
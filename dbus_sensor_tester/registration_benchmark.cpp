@@ -0,0 +1,54 @@
+#include "registration_benchmark.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+static double to_millis(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void run_registration_benchmark(boost::asio::io_context &io,
+                                const ShardConfig &config,
+                                size_t max_sensors) {
+  std::cout << "Registration times in milliseconds\n";
+  std::cout << std::setw(8) << "sensors" << std::setw(10) << "path"
+            << std::setw(10) << "add_intf" << std::setw(10) << "props"
+            << std::setw(10) << "init" << std::setw(10) << "flush"
+            << std::setw(10) << "teardown" << std::setw(10) << "total"
+            << std::setw(12) << "us/sensor" << "\n";
+  std::cout << std::fixed << std::setprecision(1);
+
+  for (size_t sensor_count = 10; sensor_count <= max_sensors;
+       sensor_count *= 10) {
+    std::shared_ptr<sdbusplus::asio::connection> connection =
+        open_connection(io);
+
+    auto shard =
+        std::make_unique<SensorShard>(connection, config, 0, sensor_count);
+    RegistrationTimes times = shard->registration_times();
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    connection->flush();
+    std::chrono::steady_clock::duration flush =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    shard.reset();
+    connection->flush();
+    std::chrono::steady_clock::duration teardown =
+        std::chrono::steady_clock::now() - start;
+
+    std::chrono::steady_clock::duration total =
+        times.total() + flush + teardown;
+    std::cout << std::setw(8) << sensor_count << std::setw(10)
+              << to_millis(times.path) << std::setw(10)
+              << to_millis(times.add_interface) << std::setw(10)
+              << to_millis(times.register_properties) << std::setw(10)
+              << to_millis(times.initialize) << std::setw(10)
+              << to_millis(flush) << std::setw(10) << to_millis(teardown)
+              << std::setw(10) << to_millis(total) << std::setw(12)
+              << to_millis(total) * 1000.0 / static_cast<double>(sensor_count)
+              << "\n";
+  }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "sensor_shard.hpp"
+
+#include <boost/asio/io_context.hpp>
+
+// Registers 10, 100, 1000, ... sensors up to max_sensors, each set on a fresh
+// connection, and prints a table of the time spent in every registration
+// phase, including flushing the queued InterfacesAdded signals and tearing
+// the objects down again.
+void run_registration_benchmark(boost::asio::io_context &io,
+                                const ShardConfig &config, size_t max_sensors);
@@ -0,0 +1,612 @@
+#include "replay.hpp"
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+#include <utility>
+
+// LINKTYPE_DBUS, every packet is one complete dbus1 message
+static constexpr uint32_t linktype_dbus = 231;
+static constexpr size_t pcap_header_size = 24;
+static constexpr size_t pcap_record_size = 16;
+
+// Deeper than the dbus1 limit of 64 nested containers is malformed
+static constexpr unsigned max_depth = 64;
+
+// Replay keeps servicing replies when it falls behind, like the shards
+static constexpr size_t send_budget = 1000;
+
+enum class MessageType : uint8_t {
+  method_call = 1,
+  signal = 4,
+};
+
+enum class HeaderField : uint8_t {
+  path = 1,
+  interface = 2,
+  member = 3,
+  destination = 6,
+  sender = 7,
+  signature = 8,
+  unix_fds = 9,
+};
+
+static constexpr uint8_t flag_no_reply_expected = 0x1;
+static constexpr uint8_t flag_no_auto_start = 0x2;
+
+// Reads the dbus1 wire format, which aligns every value to its size
+// relative to the start of the message
+class WireReader {
+public:
+  WireReader(std::span<const uint8_t> data, bool swap)
+      : data(data), swap(swap) {}
+
+  size_t position() const { return offset; }
+
+  bool align(size_t alignment) {
+    offset = (offset + alignment - 1) / alignment * alignment;
+    return offset <= data.size();
+  }
+
+  template <typename T>
+  bool read(T &value) {
+    if (!align(sizeof(T)) || data.size() - offset < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    if constexpr (sizeof(T) > 1) {
+      if (swap) {
+        value = std::byteswap(value);
+      }
+    }
+    offset += sizeof(T);
+    return true;
+  }
+
+  // Points into the message, which is nul terminated on the wire
+  bool read_string(char type, const char *&value) {
+    uint32_t length = 0;
+    if (type == 'g') {
+      uint8_t short_length = 0;
+      if (!read(short_length)) {
+        return false;
+      }
+      length = short_length;
+    } else if (!read(length)) {
+      return false;
+    }
+    if (data.size() - offset <= length || data[offset + length] != 0) {
+      return false;
+    }
+    value = reinterpret_cast<const char *>(data.data() + offset);
+    offset += length + 1;
+    return true;
+  }
+
+private:
+  std::span<const uint8_t> data;
+  bool swap;
+  size_t offset = 0;
+};
+
+static size_t alignment_of(char type) {
+  switch (type) {
+  case 'y':
+  case 'g':
+  case 'v':
+    return 1;
+  case 'n':
+  case 'q':
+    return 2;
+  case 'x':
+  case 't':
+  case 'd':
+  case '(':
+  case '{':
+    return 8;
+  default:
+    return 4;
+  }
+}
+
+// Length of the single complete type at the start of signature, 0 if there
+// is none
+static size_t complete_type_length(std::string_view signature) {
+  if (signature.empty()) {
+    return 0;
+  }
+  switch (signature[0]) {
+  case 'a': {
+    size_t element = complete_type_length(signature.substr(1));
+    return element > 0 ? element + 1 : 0;
+  }
+  case '(':
+  case '{': {
+    char close = signature[0] == '(' ? ')' : '}';
+    size_t length = 1;
+    while (length < signature.size() && signature[length] != close) {
+      size_t member = complete_type_length(signature.substr(length));
+      if (member == 0) {
+        return 0;
+      }
+      length += member;
+    }
+    return length < signature.size() ? length + 1 : 0;
+  }
+  case ')':
+  case '}':
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+template <typename T>
+static int copy_basic(WireReader &in, sd_bus_message *out, char type) {
+  T value{};
+  if (!in.read(value)) {
+    return -EBADMSG;
+  }
+  return sd_bus_message_append_basic(out, type, &value);
+}
+
+static int copy_value(WireReader &in, sd_bus_message *out,
+                      std::string_view type, unsigned depth);
+
+// Copies every complete type of signature
+static int copy_values(WireReader &in, sd_bus_message *out,
+                       std::string_view signature, unsigned depth) {
+  while (!signature.empty()) {
+    size_t length = complete_type_length(signature);
+    if (length == 0) {
+      return -EBADMSG;
+    }
+    int r = copy_value(in, out, signature.substr(0, length), depth);
+    if (r < 0) {
+      return r;
+    }
+    signature.remove_prefix(length);
+  }
+  return 0;
+}
+
+static int copy_container(WireReader &in, sd_bus_message *out, char type,
+                          const std::string &contents, unsigned depth) {
+  int r = sd_bus_message_open_container(out, type, contents.c_str());
+  if (r < 0) {
+    return r;
+  }
+  if (type == SD_BUS_TYPE_ARRAY) {
+    uint32_t length = 0;
+    if (!in.read(length) || !in.align(alignment_of(contents[0]))) {
+      return -EBADMSG;
+    }
+    size_t end = in.position() + length;
+    while (in.position() < end) {
+      r = copy_value(in, out, contents, depth + 1);
+      if (r < 0) {
+        return r;
+      }
+    }
+    if (in.position() != end) {
+      return -EBADMSG;
+    }
+  } else {
+    r = copy_values(in, out, contents, depth + 1);
+    if (r < 0) {
+      return r;
+    }
+  }
+  return sd_bus_message_close_container(out);
+}
+
+static int copy_value(WireReader &in, sd_bus_message *out,
+                      std::string_view type, unsigned depth) {
+  if (depth > max_depth) {
+    return -EBADMSG;
+  }
+  switch (type[0]) {
+  case 'y':
+    return copy_basic<uint8_t>(in, out, 'y');
+  case 'n':
+    return copy_basic<int16_t>(in, out, 'n');
+  case 'q':
+    return copy_basic<uint16_t>(in, out, 'q');
+  case 'i':
+    return copy_basic<int32_t>(in, out, 'i');
+  case 'u':
+    return copy_basic<uint32_t>(in, out, 'u');
+  case 'x':
+    return copy_basic<int64_t>(in, out, 'x');
+  case 't':
+    return copy_basic<uint64_t>(in, out, 't');
+  case 'b': {
+    uint32_t wire = 0;
+    if (!in.read(wire)) {
+      return -EBADMSG;
+    }
+    int value = wire != 0;
+    return sd_bus_message_append_basic(out, 'b', &value);
+  }
+  case 'd': {
+    uint64_t bits = 0;
+    if (!in.read(bits)) {
+      return -EBADMSG;
+    }
+    double value = std::bit_cast<double>(bits);
+    return sd_bus_message_append_basic(out, 'd', &value);
+  }
+  case 's':
+  case 'o':
+  case 'g': {
+    const char *value = nullptr;
+    if (!in.read_string(type[0], value)) {
+      return -EBADMSG;
+    }
+    return sd_bus_message_append_basic(out, type[0], value);
+  }
+  case 'v': {
+    const char *contents = nullptr;
+    if (!in.read_string('g', contents) ||
+        complete_type_length(contents) != std::strlen(contents)) {
+      return -EBADMSG;
+    }
+    return copy_container(in, out, SD_BUS_TYPE_VARIANT, contents, depth);
+  }
+  case 'a':
+    return copy_container(in, out, SD_BUS_TYPE_ARRAY,
+                          std::string(type.substr(1)), depth);
+  case '(':
+  case '{':
+    if (!in.align(8)) {
+      return -EBADMSG;
+    }
+    return copy_container(
+        in, out, type[0] == '(' ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY,
+        std::string(type.substr(1, type.size() - 2)), depth);
+  default:
+    // Unix fds can't be replayed, messages carrying them are skipped before
+    // the body is copied
+    return -EBADMSG;
+  }
+}
+
+int rebuild_message(sd_bus *bus, std::span<const uint8_t> raw,
+                    sd_bus_message **out, bool *call, bool *expect_reply) {
+  if (raw.empty() || (raw[0] != 'l' && raw[0] != 'B')) {
+    return -EBADMSG;
+  }
+  bool little_endian = raw[0] == 'l';
+  WireReader in(raw, little_endian != (std::endian::native ==
+                                       std::endian::little));
+  uint8_t endian = 0;
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  uint8_t version = 0;
+  uint32_t body_length = 0;
+  uint32_t serial = 0;
+  uint32_t fields_length = 0;
+  if (!in.read(endian) || !in.read(type) || !in.read(flags) ||
+      !in.read(version) || !in.read(body_length) || !in.read(serial) ||
+      !in.read(fields_length)) {
+    return -EBADMSG;
+  }
+
+  const char *path = nullptr;
+  const char *interface = nullptr;
+  const char *member = nullptr;
+  const char *destination = nullptr;
+  const char *sender = nullptr;
+  const char *signature = "";
+  uint32_t unix_fds = 0;
+  size_t fields_end = in.position() + fields_length;
+  while (in.position() < fields_end) {
+    uint8_t code = 0;
+    const char *field_signature = nullptr;
+    if (!in.align(8) || !in.read(code) ||
+        !in.read_string('g', field_signature) ||
+        std::strlen(field_signature) != 1) {
+      return -EBADMSG;
+    }
+    char field_type = field_signature[0];
+    const char *string = nullptr;
+    uint32_t number = 0;
+    bool ok = field_type == 'u' ? in.read(number)
+                                : in.read_string(field_type, string);
+    if (!ok) {
+      return -EBADMSG;
+    }
+    switch (static_cast<HeaderField>(code)) {
+    case HeaderField::path:
+      path = string;
+      break;
+    case HeaderField::interface:
+      interface = string;
+      break;
+    case HeaderField::member:
+      member = string;
+      break;
+    case HeaderField::destination:
+      destination = string;
+      break;
+    case HeaderField::sender:
+      sender = string;
+      break;
+    case HeaderField::signature:
+      signature = string != nullptr ? string : "";
+      break;
+    case HeaderField::unix_fds:
+      unix_fds = number;
+      break;
+    default:
+      break;
+    }
+  }
+  if (!in.align(8) || raw.size() - in.position() < body_length) {
+    return -EBADMSG;
+  }
+
+  // Replies answer calls of the original clients, the bus driver only
+  // talks for itself and nothing else has the unique names of the capture
+  bool is_call = type == static_cast<uint8_t>(MessageType::method_call);
+  if ((!is_call && type != static_cast<uint8_t>(MessageType::signal)) ||
+      (is_call && destination == nullptr) || unix_fds > 0 ||
+      (sender != nullptr && std::strcmp(sender, "org.freedesktop.DBus") == 0) ||
+      (destination != nullptr &&
+       (destination[0] == ':' ||
+        std::strcmp(destination, "org.freedesktop.DBus") == 0))) {
+    return 0;
+  }
+  if (path == nullptr || member == nullptr ||
+      (!is_call && interface == nullptr)) {
+    return -EBADMSG;
+  }
+
+  sd_bus_message *message = nullptr;
+  int r = is_call ? sd_bus_message_new_method_call(bus, &message, destination,
+                                                   path, interface, member)
+                  : sd_bus_message_new_signal(bus, &message, path, interface,
+                                              member);
+  if (r < 0) {
+    return r;
+  }
+  *call = is_call;
+  *expect_reply = is_call && (flags & flag_no_reply_expected) == 0;
+  if (is_call) {
+    sd_bus_message_set_expect_reply(message, *expect_reply ? 1 : 0);
+    sd_bus_message_set_auto_start(
+        message, (flags & flag_no_auto_start) == 0 ? 1 : 0);
+  } else if (destination != nullptr) {
+    sd_bus_message_set_destination(message, destination);
+  }
+  r = copy_values(in, message, signature, 0);
+  if (r < 0) {
+    sd_bus_message_unref(message);
+    return r;
+  }
+  *out = message;
+  return 1;
+}
+
+static uint32_t read_u32(const std::vector<uint8_t> &data, size_t offset,
+                         bool swap) {
+  uint32_t value = 0;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+  return swap ? std::byteswap(value) : value;
+}
+
+std::optional<std::vector<CapturedMessage>>
+load_capture(sdbusplus::bus_t &bus, const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    std::cerr << "Can't open capture " << filename << "\n";
+    return std::nullopt;
+  }
+  std::vector<uint8_t> data{std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>()};
+  if (data.size() < pcap_header_size) {
+    std::cerr << filename << " is not a pcap capture\n";
+    return std::nullopt;
+  }
+
+  // The magic tells the byte order of the capture and whether its
+  // timestamps have microsecond or nanosecond fractions
+  uint32_t magic = read_u32(data, 0, false);
+  bool swap = false;
+  uint64_t fraction_ns = 1000;
+  switch (magic) {
+  case 0xa1b2c3d4:
+    break;
+  case 0xd4c3b2a1:
+    swap = true;
+    break;
+  case 0xa1b23c4d:
+    fraction_ns = 1;
+    break;
+  case 0x4d3cb2a1:
+    swap = true;
+    fraction_ns = 1;
+    break;
+  case 0x0a0d0d0a:
+    std::cerr << filename << " is pcapng, convert it with "
+              << "editcap -F pcap first\n";
+    return std::nullopt;
+  default:
+    std::cerr << filename << " is not a pcap capture\n";
+    return std::nullopt;
+  }
+  if (read_u32(data, 20, swap) != linktype_dbus) {
+    std::cerr << filename << " is not a D-Bus capture\n";
+    return std::nullopt;
+  }
+
+  std::vector<CapturedMessage> messages;
+  size_t signals = 0;
+  size_t skipped = 0;
+  size_t truncated = 0;
+  size_t malformed = 0;
+  std::optional<uint64_t> first_ns;
+  size_t offset = pcap_header_size;
+  while (data.size() - offset >= pcap_record_size) {
+    uint64_t seconds = read_u32(data, offset, swap);
+    uint64_t fraction = read_u32(data, offset + 4, swap);
+    uint32_t captured = read_u32(data, offset + 8, swap);
+    uint32_t original = read_u32(data, offset + 12, swap);
+    offset += pcap_record_size;
+    if (data.size() - offset < captured) {
+      truncated++;
+      break;
+    }
+    std::span<const uint8_t> raw(data.data() + offset, captured);
+    offset += captured;
+    if (captured < original) {
+      truncated++;
+      continue;
+    }
+
+    sd_bus_message *message = nullptr;
+    CapturedMessage entry;
+    int r = rebuild_message(bus.get(), raw, &message, &entry.call,
+                            &entry.expect_reply);
+    if (r < 0) {
+      malformed++;
+      continue;
+    }
+    if (r == 0) {
+      skipped++;
+      continue;
+    }
+    entry.message = sdbusplus::message_t(message);
+    sd_bus_message_unref(message);
+
+    uint64_t time_ns = seconds * 1000000000 + fraction * fraction_ns;
+    if (!first_ns) {
+      first_ns = time_ns;
+    }
+    entry.offset = std::chrono::nanoseconds(
+        time_ns > *first_ns ? time_ns - *first_ns : 0);
+    signals += entry.call ? 0 : 1;
+    messages.emplace_back(std::move(entry));
+  }
+
+  std::cout << "Loaded " << signals << " signals and "
+            << messages.size() - signals << " method calls from "
+            << filename << ", skipped " << skipped
+            << " replies, bus driver and unreplayable messages, " << truncated
+            << " truncated and " << malformed << " malformed";
+  if (!messages.empty()) {
+    std::cout << ", spanning "
+              << std::chrono::duration<double>(messages.back().offset).count()
+              << " seconds";
+  }
+  std::cout << "\n";
+  return messages;
+}
+
+void ReplayStats::merge(const ReplayStats &other) {
+  signals += other.signals;
+  calls += other.calls;
+  replies += other.replies;
+  errors += other.errors;
+  lag.merge(other.lag);
+  call_latency.merge(other.call_latency);
+}
+
+nlohmann::json ReplayStats::to_json() const {
+  return {
+      {"signals", signals},
+      {"calls", calls},
+      {"replies", replies},
+      {"errors", errors},
+      {"lag", lag.to_json()},
+      {"call_latency", call_latency.to_json()},
+  };
+}
+
+Replayer::Replayer(std::shared_ptr<sdbusplus::asio::connection> connection,
+                   std::vector<CapturedMessage> messages, double speed)
+    : connection(connection), messages(std::move(messages)), speed(speed),
+      timer(connection->get_io_context()) {}
+
+void Replayer::start(std::function<void()> done) {
+  this->done = std::move(done);
+  start_time = std::chrono::steady_clock::now();
+  timer.expires_at(start_time);
+  timer.async_wait(std::bind_front(&Replayer::on_timer, this));
+}
+
+ReplayStats Replayer::take_stats() {
+  return std::exchange(stats, ReplayStats());
+}
+
+void Replayer::on_timer(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+  auto deadline = [this](const CapturedMessage &captured) {
+    if (speed <= 0.0) {
+      return start_time;
+    }
+    return start_time +
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               std::chrono::duration<double, std::nano>(
+                   static_cast<double>(captured.offset.count()) / speed));
+  };
+
+  for (size_t budget = send_budget; budget > 0 && next < messages.size() &&
+                                    deadline(messages[next]) <=
+                                        std::chrono::steady_clock::now();
+       budget--) {
+    stats.lag.record(std::chrono::steady_clock::now() -
+                     deadline(messages[next]));
+    send(messages[next]);
+    next++;
+  }
+  if (next == messages.size()) {
+    finish_if_done();
+    return;
+  }
+  timer.expires_at(deadline(messages[next]));
+  timer.async_wait(std::bind_front(&Replayer::on_timer, this));
+}
+
+void Replayer::send(CapturedMessage &captured) {
+  if (!captured.call) {
+    stats.signals++;
+  } else {
+    stats.calls++;
+  }
+  if (!captured.expect_reply) {
+    if (sd_bus_send(connection->get(), captured.message.get(), nullptr) < 0) {
+      stats.errors++;
+    }
+    return;
+  }
+  outstanding++;
+  connection->async_send(
+      captured.message,
+      [this, start = std::chrono::steady_clock::now()](
+          const boost::system::error_code &error,
+          sdbusplus::message_t reply) {
+        outstanding--;
+        stats.call_latency.record(std::chrono::steady_clock::now() - start);
+        if (error || reply.is_method_error()) {
+          stats.errors++;
+        } else {
+          stats.replies++;
+        }
+        finish_if_done();
+      });
+}
+
+void Replayer::finish_if_done() {
+  if (next < messages.size() || outstanding > 0 || !done) {
+    return;
+  }
+  std::function<void()> finished = std::exchange(done, nullptr);
+  finished();
+}
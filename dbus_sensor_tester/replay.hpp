@@ -0,0 +1,83 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <sdbusplus/asio/connection.hpp>
+#include <span>
+#include <string>
+#include <systemd/sd-bus.h>
+#include <vector>
+
+// A signal or method call of a capture, rebuilt on the replaying connection
+struct CapturedMessage {
+  // Capture time relative to the first message replayed
+  std::chrono::nanoseconds offset{0};
+  sdbusplus::message_t message;
+  bool call = false;
+  bool expect_reply = false;
+};
+
+// Rebuilds one dbus1 marshalled message as a new signal or method call on
+// bus, with the same path, interface, member, destination and body.
+// Returns 0 for messages that are not replayed (replies, errors, anything to
+// or from the bus driver, calls to unique names and messages carrying file
+// descriptors), 1 with the new message in out, or a negative errno if the
+// message is malformed.
+int rebuild_message(sd_bus *bus, std::span<const uint8_t> raw,
+                    sd_bus_message **out, bool *call, bool *expect_reply);
+
+// Loads the signals and method calls of a pcap capture, as written by
+// busctl capture or dbus-monitor --pcap and read by dbus-pcap
+std::optional<std::vector<CapturedMessage>>
+load_capture(sdbusplus::bus_t &bus, const std::string &filename);
+
+struct ReplayStats {
+  size_t signals = 0;
+  size_t calls = 0;
+  size_t replies = 0;
+  size_t errors = 0;
+  // How late each message went out relative to its place in the capture
+  Histogram lag;
+  Histogram call_latency;
+
+  void merge(const ReplayStats &other);
+  nlohmann::json to_json() const;
+};
+
+// Sends a capture again, keeping the original inter-arrival times divided
+// by speed, or as fast as the bus takes it with a speed of 0.  Messages are
+// scheduled against absolute deadlines like the shards' updates, so a bus
+// that can't keep up shows as lag rather than a slower replay.
+class Replayer {
+public:
+  Replayer(std::shared_ptr<sdbusplus::asio::connection> connection,
+           std::vector<CapturedMessage> messages, double speed);
+
+  // Calls done once every message is sent and every call answered
+  void start(std::function<void()> done);
+  ReplayStats take_stats();
+  size_t remaining() const { return messages.size() - next; }
+
+private:
+  void on_timer(const boost::system::error_code &error);
+  void send(CapturedMessage &captured);
+  void finish_if_done();
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  std::vector<CapturedMessage> messages;
+  double speed;
+  boost::asio::steady_timer timer;
+  std::chrono::steady_clock::time_point start_time;
+  size_t next = 0;
+  size_t outstanding = 0;
+  std::function<void()> done;
+  ReplayStats stats;
+};
@@ -0,0 +1,237 @@
+#include "resources.hpp"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+static std::chrono::nanoseconds from_timeval(const timeval &value) {
+  return std::chrono::seconds(value.tv_sec) +
+         std::chrono::microseconds(value.tv_usec);
+}
+
+static std::optional<pid_t> parse_pid(std::string_view text) {
+  pid_t pid = 0;
+  auto [end, error] = std::from_chars(text.data(), text.data() + text.size(),
+                                      pid);
+  if (error != std::errc() || end != text.data() + text.size() || pid <= 0) {
+    return std::nullopt;
+  }
+  return pid;
+}
+
+// Fields of /proc/<pid>/stat following the parenthesised command name,
+// which may itself contain spaces.  Index 0 is field 3, the state.
+static std::vector<std::string> stat_fields(const std::string &proc_dir) {
+  std::ifstream file(proc_dir + "/stat");
+  std::string line;
+  std::getline(file, line);
+  size_t comm_end = line.rfind(')');
+  if (comm_end == std::string::npos) {
+    return {};
+  }
+  std::istringstream rest(line.substr(comm_end + 1));
+  std::vector<std::string> fields;
+  std::string field;
+  while (rest >> field) {
+    fields.emplace_back(field);
+  }
+  return fields;
+}
+
+static uint64_t stat_field(const std::vector<std::string> &fields,
+                           size_t field_number) {
+  uint64_t value = 0;
+  const std::string &text = fields[field_number - 3];
+  std::from_chars(text.data(), text.data() + text.size(), value);
+  return value;
+}
+
+static uint64_t resident_bytes(const std::vector<std::string> &fields) {
+  return stat_field(fields, 24) *
+         static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::optional<ProcessUsage> self_usage() {
+  rusage usage{};
+  std::vector<std::string> fields = stat_fields("/proc/self");
+  if (getrusage(RUSAGE_SELF, &usage) != 0 || fields.size() < 22) {
+    return std::nullopt;
+  }
+  ProcessUsage result;
+  result.cpu = from_timeval(usage.ru_utime) + from_timeval(usage.ru_stime);
+  result.rss_bytes = resident_bytes(fields);
+  result.voluntary_switches = static_cast<uint64_t>(usage.ru_nvcsw);
+  result.involuntary_switches = static_cast<uint64_t>(usage.ru_nivcsw);
+  return result;
+}
+
+std::optional<ProcessUsage> process_usage(pid_t pid) {
+  std::string proc_dir = "/proc/" + std::to_string(pid);
+  std::vector<std::string> fields = stat_fields(proc_dir);
+  if (fields.size() < 22) {
+    return std::nullopt;
+  }
+  ProcessUsage result;
+  uint64_t ticks = stat_field(fields, 14) + stat_field(fields, 15);
+  uint64_t ticks_per_second = static_cast<uint64_t>(sysconf(_SC_CLK_TCK));
+  result.cpu = std::chrono::nanoseconds(ticks * 1000000000 / ticks_per_second);
+  result.rss_bytes = resident_bytes(fields);
+
+  // The context switch counts are only in status
+  std::ifstream status(proc_dir + "/status");
+  std::string key;
+  uint64_t value = 0;
+  while (status >> key) {
+    if (key == "voluntary_ctxt_switches:" && status >> value) {
+      result.voluntary_switches = value;
+    } else if (key == "nonvoluntary_ctxt_switches:" && status >> value) {
+      result.involuntary_switches = value;
+    }
+  }
+  return result;
+}
+
+static std::optional<pid_t> find_process(const std::string &name) {
+  std::error_code error;
+  for (const auto &entry :
+       std::filesystem::directory_iterator("/proc", error)) {
+    std::optional<pid_t> pid = parse_pid(entry.path().filename().native());
+    if (!pid) {
+      continue;
+    }
+    std::ifstream file(entry.path() / "comm");
+    std::string comm;
+    if (std::getline(file, comm) && comm == name) {
+      return pid;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<pid_t> find_broker(const std::string &name_or_pid) {
+  if (!name_or_pid.empty()) {
+    std::optional<pid_t> pid = parse_pid(name_or_pid);
+    return pid ? pid : find_process(name_or_pid);
+  }
+  for (const char *name : {"dbus-broker", "dbus-daemon"}) {
+    std::optional<pid_t> pid = find_process(name);
+    if (pid) {
+      return pid;
+    }
+  }
+  return std::nullopt;
+}
+
+double ResourceInterval::cpu_percent() const {
+  if (wall.count() <= 0) {
+    return 0.0;
+  }
+  return 100.0 * static_cast<double>(cpu.count()) /
+         static_cast<double>(wall.count());
+}
+
+double ResourceInterval::cpu_percent_per_k(uint64_t events) const {
+  double per_second = static_cast<double>(events) /
+                      std::chrono::duration<double>(wall).count();
+  if (events == 0 || per_second <= 0.0) {
+    return 0.0;
+  }
+  return cpu_percent() / (per_second / 1000.0);
+}
+
+static std::string format_bytes(double bytes) {
+  constexpr std::array<const char *, 4> units{"B", "KiB", "MiB", "GiB"};
+  size_t unit = 0;
+  while (std::abs(bytes) >= 1024.0 && unit + 1 < units.size()) {
+    bytes /= 1024.0;
+    unit++;
+  }
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " "
+      << units[unit];
+  return out.str();
+}
+
+std::string ResourceInterval::summary(uint64_t events,
+                                      const char *event_name) const {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1) << "cpu " << cpu_percent() << "%";
+  if (events > 0) {
+    out << " (" << cpu_percent_per_k(events) << "% per 1k " << event_name
+        << "/s)";
+  }
+  out << ", rss " << format_bytes(static_cast<double>(rss_bytes)) << " ("
+      << (rss_growth_bytes < 0 ? "-" : "+")
+      << format_bytes(std::abs(static_cast<double>(rss_growth_bytes)))
+      << "), " << voluntary_switches << " voluntary / "
+      << involuntary_switches << " involuntary context switches";
+  return out.str();
+}
+
+nlohmann::json ResourceInterval::to_json(uint64_t events) const {
+  return {
+      {"cpu_percent", cpu_percent()},
+      {"cpu_percent_per_k", cpu_percent_per_k(events)},
+      {"rss_bytes", rss_bytes},
+      {"rss_growth_bytes", rss_growth_bytes},
+      {"voluntary_switches", voluntary_switches},
+      {"involuntary_switches", involuntary_switches},
+  };
+}
+
+ResourceMonitor::ResourceMonitor(std::optional<pid_t> pid)
+    : pid(pid), first(usage()),
+      first_time(std::chrono::steady_clock::now()), last_time(first_time) {
+  if (first) {
+    last = *first;
+  }
+}
+
+std::optional<ProcessUsage> ResourceMonitor::usage() const {
+  return pid ? process_usage(*pid) : self_usage();
+}
+
+static ResourceInterval difference(const ProcessUsage &before,
+                                   const ProcessUsage &after,
+                                   std::chrono::nanoseconds wall) {
+  ResourceInterval interval;
+  interval.wall = wall;
+  interval.cpu = after.cpu - before.cpu;
+  interval.rss_bytes = after.rss_bytes;
+  interval.rss_growth_bytes = static_cast<int64_t>(after.rss_bytes) -
+                              static_cast<int64_t>(before.rss_bytes);
+  interval.voluntary_switches =
+      after.voluntary_switches - before.voluntary_switches;
+  interval.involuntary_switches =
+      after.involuntary_switches - before.involuntary_switches;
+  return interval;
+}
+
+std::optional<ResourceInterval> ResourceMonitor::sample() {
+  std::optional<ProcessUsage> now = usage();
+  if (!first || !now) {
+    return std::nullopt;
+  }
+  std::chrono::steady_clock::time_point now_time =
+      std::chrono::steady_clock::now();
+  ResourceInterval interval = difference(last, *now, now_time - last_time);
+  last = *now;
+  last_time = now_time;
+  return interval;
+}
+
+std::optional<ResourceInterval> ResourceMonitor::total() const {
+  if (!first) {
+    return std::nullopt;
+  }
+  return difference(*first, last, last_time - first_time);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Cumulative CPU time, current resident memory and cumulative context
+// switches of one process, all threads included
+struct ProcessUsage {
+  std::chrono::nanoseconds cpu{0};
+  uint64_t rss_bytes = 0;
+  uint64_t voluntary_switches = 0;
+  uint64_t involuntary_switches = 0;
+};
+
+// This process, from getrusage, with the current RSS from /proc/self/stat
+// since getrusage only has the peak
+std::optional<ProcessUsage> self_usage();
+
+// Any other process, from /proc/<pid>/stat and /proc/<pid>/status
+std::optional<ProcessUsage> process_usage(pid_t pid);
+
+// name_or_pid is either a PID or a name matched against /proc/*/comm.  An
+// empty string looks for dbus-broker, then dbus-daemon.
+std::optional<pid_t> find_broker(const std::string &name_or_pid);
+
+// What a process used between two samples
+struct ResourceInterval {
+  std::chrono::nanoseconds wall{0};
+  std::chrono::nanoseconds cpu{0};
+  uint64_t rss_bytes = 0;
+  int64_t rss_growth_bytes = 0;
+  uint64_t voluntary_switches = 0;
+  uint64_t involuntary_switches = 0;
+
+  // Percent of one core, above 100 for a multithreaded process
+  double cpu_percent() const;
+  // cpu_percent() divided by thousands of events per second, the cost of
+  // sensor traffic independent of the rate it was measured at
+  double cpu_percent_per_k(uint64_t events) const;
+
+  // e.g. "cpu 12.3% (4.1% per 1k updates/s), rss 10.2 MiB (+12 KiB),
+  // 120 voluntary / 3 involuntary context switches"
+  std::string summary(uint64_t events, const char *event_name) const;
+  nlohmann::json to_json(uint64_t events) const;
+};
+
+// Samples the usage of a process on every report
+class ResourceMonitor {
+public:
+  // Without a pid this process is monitored
+  explicit ResourceMonitor(std::optional<pid_t> pid = std::nullopt);
+
+  // Usage since the previous sample, nullopt if the process has gone away
+  std::optional<ResourceInterval> sample();
+  // Usage since the monitor was created
+  std::optional<ResourceInterval> total() const;
+
+private:
+  std::optional<ProcessUsage> usage() const;
+
+  std::optional<pid_t> pid;
+  std::optional<ProcessUsage> first;
+  ProcessUsage last;
+  std::chrono::steady_clock::time_point first_time;
+  std::chrono::steady_clock::time_point last_time;
+};
@@ -0,0 +1,290 @@
+#include "results.hpp"
+
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
+void RunResults::add_sample(const IntervalSample &sample) {
+  samples.emplace_back(sample);
+}
+
+nlohmann::json RunResults::summary(nlohmann::json latency) const {
+  uint64_t updates = 0;
+  uint64_t signals = 0;
+  uint64_t unchanged = 0;
+  uint64_t suppressed = 0;
+  uint64_t missed_deadlines = 0;
+  uint64_t reads = 0;
+  uint64_t read_replies = 0;
+  uint64_t read_errors = 0;
+  uint64_t deliveries = 0;
+  uint64_t shm_values = 0;
+  for (const IntervalSample &sample : samples) {
+    updates += sample.updates;
+    signals += sample.signals;
+    unchanged += sample.unchanged;
+    suppressed += sample.suppressed;
+    missed_deadlines += sample.missed_deadlines;
+    reads += sample.reads;
+    read_replies += sample.read_replies;
+    read_errors += sample.read_errors;
+    deliveries += sample.deliveries;
+    shm_values += sample.shm_values;
+  }
+  double duration = samples.empty() ? 0.0 : samples.back().elapsed;
+  auto per_second = [duration](uint64_t count) {
+    return duration > 0.0 ? static_cast<double>(count) / duration : 0.0;
+  };
+
+  latency["duration_s"] = duration;
+  latency["updates"] = updates;
+  latency["signals"] = signals;
+  latency["unchanged"] = unchanged;
+  latency["suppressed"] = suppressed;
+  latency["missed_deadlines"] = missed_deadlines;
+  latency["reads"] = reads;
+  latency["read_replies"] = read_replies;
+  latency["read_errors"] = read_errors;
+  latency["deliveries"] = deliveries;
+  latency["shm_values"] = shm_values;
+  latency["updates_per_second"] = per_second(updates);
+  latency["signals_per_second"] = per_second(signals);
+  latency["reads_per_second"] = per_second(reads);
+  latency["read_replies_per_second"] = per_second(read_replies);
+  latency["deliveries_per_second"] = per_second(deliveries);
+  latency["shm_values_per_second"] = per_second(shm_values);
+  return latency;
+}
+
+static nlohmann::json sample_json(const IntervalSample &sample) {
+  return {
+      {"elapsed_s", sample.elapsed},
+      {"updates", sample.updates},
+      {"signals", sample.signals},
+      {"unchanged", sample.unchanged},
+      {"suppressed", sample.suppressed},
+      {"missed_deadlines", sample.missed_deadlines},
+      {"reads", sample.reads},
+      {"read_replies", sample.read_replies},
+      {"read_errors", sample.read_errors},
+      {"set_property_p50_ns", sample.set_property_p50.count()},
+      {"set_property_p99_ns", sample.set_property_p99.count()},
+      {"schedule_lag_p99_ns", sample.schedule_lag_p99.count()},
+      {"signal_p50_ns", sample.signal_p50.count()},
+      {"signal_p99_ns", sample.signal_p99.count()},
+      {"read_p50_ns", sample.read_p50.count()},
+      {"read_p99_ns", sample.read_p99.count()},
+      {"deliveries", sample.deliveries},
+      {"delivery_p50_ns", sample.delivery_p50.count()},
+      {"delivery_p99_ns", sample.delivery_p99.count()},
+      {"shm_publish_p50_ns", sample.shm_publish_p50.count()},
+      {"shm_publish_p99_ns", sample.shm_publish_p99.count()},
+      {"shm_values", sample.shm_values},
+      {"shm_p50_ns", sample.shm_p50.count()},
+      {"shm_p99_ns", sample.shm_p99.count()},
+      {"shm_cpu_percent", sample.shm_cpu_percent},
+      {"tester_cpu_percent", sample.tester_cpu_percent},
+      {"tester_rss_bytes", sample.tester_rss_bytes},
+      {"broker_cpu_percent", sample.broker_cpu_percent},
+      {"broker_rss_bytes", sample.broker_rss_bytes},
+  };
+}
+
+bool RunResults::write_json(const std::string &filename,
+                            const nlohmann::json &summary) const {
+  nlohmann::json::array_t intervals;
+  for (const IntervalSample &sample : samples) {
+    intervals.emplace_back(sample_json(sample));
+  }
+  nlohmann::json output = {
+      {"metadata", metadata},
+      {"intervals", intervals},
+      {"summary", summary},
+  };
+  std::ofstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open " << filename << " for writing\n";
+    return false;
+  }
+  file << output.dump(2) << "\n";
+  return true;
+}
+
+// The metadata and summary go in "# metadata key,value" and "# summary
+// key,value" comment lines around the interval rows, so the file still loads
+// as a single table.  Nested keys are joined with "/", histogram buckets are
+// left out.
+bool RunResults::write_csv(const std::string &filename,
+                           const nlohmann::json &summary) const {
+  std::ofstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open " << filename << " for writing\n";
+    return false;
+  }
+  nlohmann::json flat_metadata = metadata.flatten();
+  for (const auto &[key, value] : flat_metadata.items()) {
+    file << "# metadata " << key.substr(1) << "," << value << "\n";
+  }
+
+  nlohmann::json header = sample_json(IntervalSample());
+  const char *separator = "";
+  for (const auto &column : header.items()) {
+    file << separator << column.key();
+    separator = ",";
+  }
+  file << "\n";
+  for (const IntervalSample &sample : samples) {
+    separator = "";
+    nlohmann::json row = sample_json(sample);
+    for (const auto &column : row.items()) {
+      file << separator << column.value();
+      separator = ",";
+    }
+    file << "\n";
+  }
+
+  nlohmann::json flat_summary = summary.flatten();
+  for (const auto &[key, value] : flat_summary.items()) {
+    if (key.find("/buckets/") == std::string::npos) {
+      file << "# summary " << key.substr(1) << "," << value << "\n";
+    }
+  }
+  return true;
+}
+
+static std::optional<nlohmann::json> load_results(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open " << filename << "\n";
+    return std::nullopt;
+  }
+  nlohmann::json results = nlohmann::json::parse(file, nullptr, false);
+  if (results.is_discarded() || !results.contains("summary")) {
+    std::cerr << filename << " is not a --json result file\n";
+    return std::nullopt;
+  }
+  return results;
+}
+
+struct Metric {
+  const char *pointer;
+  bool higher_is_better;
+};
+
+// Metrics missing from either run, such as the read latencies of a run
+// without --read, are skipped.  A zero baseline has no percentage, so a
+// counter like missed_deadlines going from zero to any value is reported
+// with its absolute change and always counts as a regression
+constexpr std::array<Metric, 26> metrics{{
+    {"/summary/updates_per_second", true},
+    {"/summary/reads_per_second", true},
+    {"/summary/read_replies_per_second", true},
+    {"/summary/missed_deadlines", false},
+    {"/summary/set_property/p50_ns", false},
+    {"/summary/set_property/p99_ns", false},
+    {"/summary/signal/p50_ns", false},
+    {"/summary/signal/p99_ns", false},
+    {"/summary/read/p50_ns", false},
+    {"/summary/read/p99_ns", false},
+    {"/summary/read/errors", false},
+    {"/summary/end_to_end/p50_ns", false},
+    {"/summary/end_to_end/p99_ns", false},
+    {"/summary/end_to_end/p99_9_ns", false},
+    {"/summary/end_to_end/dropped", false},
+    {"/summary/replay/errors", false},
+    {"/summary/tester/cpu_percent_per_k", false},
+    {"/summary/broker/cpu_percent_per_k", false},
+    {"/summary/broker/cpu_ns_per_signal", false},
+    {"/summary/broker/cpu_ns_per_delivery", false},
+    {"/summary/delivery/p50_ns", false},
+    {"/summary/delivery/p99_ns", false},
+    {"/summary/shm_publish/p99_ns", false},
+    {"/summary/shm_visible/p50_ns", false},
+    {"/summary/shm_visible/p99_ns", false},
+    {"/summary/shm_visible/cpu_ns_per_value", false},
+}};
+
+// A benchmark only compares to another run of the same benchmark
+constexpr std::array<const char *, 12> comparable_metadata{
+    "sensors",    "connections", "rate",     "interval_s",
+    "profile",    "watchers",    "matches",  "match_style",
+    "build_type", "noise",       "deadband", "hysteresis",
+};
+
+static nlohmann::json metadata_value(const nlohmann::json &results,
+                                     const char *key) {
+  nlohmann::json::json_pointer path("/metadata/" + std::string(key));
+  return results.contains(path) ? results.at(path) : nlohmann::json();
+}
+
+static std::optional<double> metric_value(const nlohmann::json &results,
+                                          const char *pointer) {
+  nlohmann::json::json_pointer path(pointer);
+  if (!results.contains(path) || !results.at(path).is_number()) {
+    return std::nullopt;
+  }
+  return results.at(path).get<double>();
+}
+
+int compare_results(const std::string &baseline, const std::string &candidate,
+                    double threshold_percent) {
+  std::optional<nlohmann::json> before = load_results(baseline);
+  std::optional<nlohmann::json> after = load_results(candidate);
+  if (!before || !after) {
+    return -1;
+  }
+
+  for (const char *key : comparable_metadata) {
+    nlohmann::json old_value = metadata_value(*before, key);
+    nlohmann::json new_value = metadata_value(*after, key);
+    if (old_value != new_value) {
+      std::cout << "Warning: " << key << " differs, " << old_value.dump()
+                << " vs " << new_value.dump() << "\n";
+    }
+  }
+
+  size_t regressions = 0;
+  std::cout << std::left << std::setw(36) << "metric" << std::right
+            << std::setw(16) << "baseline" << std::setw(16) << "candidate"
+            << std::setw(10) << "change" << "\n";
+  for (const Metric &metric : metrics) {
+    std::optional<double> old_value = metric_value(*before, metric.pointer);
+    std::optional<double> new_value = metric_value(*after, metric.pointer);
+    if (!old_value || !new_value) {
+      continue;
+    }
+    std::string_view name = std::string_view(metric.pointer).substr(9);
+    std::cout << std::left << std::setw(36) << name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(16)
+              << *old_value << std::setw(16) << *new_value << std::showpos;
+    bool regressed = false;
+    if (*old_value == 0.0) {
+      double change = *new_value - *old_value;
+      std::cout << std::setw(10) << change << std::noshowpos;
+      regressed = metric.higher_is_better ? change < 0.0 : change > 0.0;
+    } else {
+      double change =
+          (*new_value - *old_value) / std::abs(*old_value) * 100.0;
+      std::cout << std::setw(9) << change << "%" << std::noshowpos;
+      double worse = metric.higher_is_better ? -change : change;
+      regressed = worse > threshold_percent;
+    }
+    if (regressed) {
+      std::cout << "  REGRESSION";
+      regressions++;
+    }
+    std::cout << "\n";
+  }
+
+  if (regressions > 0) {
+    std::cout << regressions << " metrics regressed, by more than "
+              << threshold_percent << "% or from a zero baseline\n";
+    return 1;
+  }
+  std::cout << "No regressions beyond " << threshold_percent << "%\n";
+  return 0;
+}
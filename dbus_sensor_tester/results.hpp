@@ -0,0 +1,73 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What happened during one report interval, as printed to stdout
+struct IntervalSample {
+  // Seconds since the reporter started
+  double elapsed = 0.0;
+  uint64_t updates = 0;
+  uint64_t signals = 0;
+  uint64_t unchanged = 0;
+  // Changed values the deadband kept back
+  uint64_t suppressed = 0;
+  uint64_t missed_deadlines = 0;
+  uint64_t reads = 0;
+  uint64_t read_replies = 0;
+  uint64_t read_errors = 0;
+  std::chrono::nanoseconds set_property_p50{0};
+  std::chrono::nanoseconds set_property_p99{0};
+  std::chrono::nanoseconds schedule_lag_p99{0};
+  std::chrono::nanoseconds signal_p50{0};
+  std::chrono::nanoseconds signal_p99{0};
+  std::chrono::nanoseconds read_p50{0};
+  std::chrono::nanoseconds read_p99{0};
+  // Signals delivered to the --watchers connections
+  uint64_t deliveries = 0;
+  std::chrono::nanoseconds delivery_p50{0};
+  std::chrono::nanoseconds delivery_p99{0};
+  // Writes into the shared memory snapshot, and the values its poller saw
+  std::chrono::nanoseconds shm_publish_p50{0};
+  std::chrono::nanoseconds shm_publish_p99{0};
+  uint64_t shm_values = 0;
+  std::chrono::nanoseconds shm_p50{0};
+  std::chrono::nanoseconds shm_p99{0};
+  double shm_cpu_percent = 0.0;
+  double tester_cpu_percent = 0.0;
+  uint64_t tester_rss_bytes = 0;
+  double broker_cpu_percent = 0.0;
+  uint64_t broker_rss_bytes = 0;
+};
+
+// Collects the per-interval samples of a run for --json and --csv.  Both
+// files carry the run metadata, the samples and a summary; the summary is
+// what compare_results looks at.
+class RunResults {
+public:
+  nlohmann::json metadata;
+
+  void add_sample(const IntervalSample &sample);
+
+  // Totals and rates over all samples, merged into latency, which holds
+  // the whole run histograms
+  nlohmann::json summary(nlohmann::json latency) const;
+
+  bool write_json(const std::string &filename,
+                  const nlohmann::json &summary) const;
+  bool write_csv(const std::string &filename,
+                 const nlohmann::json &summary) const;
+
+private:
+  std::vector<IntervalSample> samples;
+};
+
+// Compares the summaries of two --json files and prints every metric that
+// got worse by more than threshold_percent.  Returns 1 if any did, 0 if
+// none did and -1 if a file can't be read.
+int compare_results(const std::string &baseline, const std::string &candidate,
+                    double threshold_percent);
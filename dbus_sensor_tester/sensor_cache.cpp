@@ -0,0 +1,234 @@
+#include "sensor_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <sdbusplus/vtable.hpp>
+#include <utility>
+
+static constexpr const char *sensors_root = "/xyz/openbmc_project/sensors";
+static constexpr const char *value_interface =
+    "xyz.openbmc_project.Sensor.Value";
+static constexpr const char *cached_interface =
+    "xyz.openbmc_project.SensorTester.Cached";
+
+static uint64_t steady_clock_us() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+SensorCache::SensorCache(
+    std::shared_ptr<sdbusplus::asio::connection> connection)
+    : connection(connection) {}
+
+SensorCache::~SensorCache() {
+  for (sd_bus_slot *slot : slots) {
+    sd_bus_slot_unref(slot);
+  }
+}
+
+void SensorCache::start(const std::string &cache_service,
+                        const std::string &source_service) {
+  static constexpr sdbusplus::vtable::vtable_t value_vtable[] = {
+      sdbusplus::vtable::start(),
+      sdbusplus::vtable::property("Value", "d", get_value),
+      sdbusplus::vtable::end(),
+  };
+  static constexpr sdbusplus::vtable::vtable_t cached_vtable[] = {
+      sdbusplus::vtable::start(),
+      sdbusplus::vtable::property("LastUpdate", "t", get_last_update),
+      sdbusplus::vtable::end(),
+  };
+
+  sd_bus *bus = connection->get();
+  sd_bus_slot *slot = nullptr;
+  if (sd_bus_add_object_manager(bus, &slot, "/") >= 0) {
+    slots.emplace_back(slot);
+  }
+  if (sd_bus_add_node_enumerator(bus, &slot, sensors_root, enumerate, this) >=
+      0) {
+    slots.emplace_back(slot);
+  }
+  for (auto [interface, vtable] :
+       {std::pair{value_interface, value_vtable},
+        std::pair{cached_interface, cached_vtable}}) {
+    if (sd_bus_add_fallback_vtable(bus, &slot, sensors_root, interface,
+                                   vtable, find, this) < 0) {
+      std::cerr << "Can't serve " << interface << " from the cache\n";
+      continue;
+    }
+    slots.emplace_back(slot);
+  }
+
+  try {
+    connection->request_name(cache_service.c_str());
+  } catch (const sdbusplus::exception_t &e) {
+    std::cerr << "Can't claim " << cache_service << ": " << e.what() << "\n";
+  }
+
+  sdbusplus::message_t list = connection->new_method_call(
+      source_service.c_str(), "/", "org.freedesktop.DBus.ObjectManager",
+      "GetManagedObjects");
+  connection->async_send(
+      list, [this, source_service](const boost::system::error_code &error,
+                                   sdbusplus::message_t reply) {
+        if (error) {
+          std::cerr << "Can't seed the cache from " << source_service
+                    << ": " << error.message() << "\n";
+          return;
+        }
+        seed(reply);
+      });
+}
+
+std::optional<uint32_t> SensorCache::slot_of(std::string_view path) const {
+  auto entry = index.find(path);
+  if (entry == index.end()) {
+    return std::nullopt;
+  }
+  return entry->second;
+}
+
+uint32_t SensorCache::intern(std::string_view path) {
+  if (std::optional<uint32_t> slot = slot_of(path)) {
+    return *slot;
+  }
+  uint32_t slot = static_cast<uint32_t>(entries.size());
+  const std::string &interned = paths.emplace_back(path);
+  index.emplace(interned, slot);
+  entries.emplace_back();
+  return slot;
+}
+
+void SensorCache::update(std::string_view path, double value) {
+  CacheEntry &entry = entries[intern(path)];
+  entry.value = value;
+  entry.updated_us = steady_clock_us();
+  updates++;
+}
+
+// a{oa{sa{sv}}}.  Values that a signal already brought in are newer and
+// kept.
+void SensorCache::seed(sdbusplus::message_t &reply) {
+  sd_bus_message *m = reply.get();
+  size_t seeded = 0;
+  if (sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{oa{sa{sv}}}") <
+      0) {
+    std::cerr << "Unexpected GetManagedObjects reply\n";
+    return;
+  }
+  while (sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                        "oa{sa{sv}}") > 0) {
+    const char *path = nullptr;
+    sd_bus_message_read_basic(m, SD_BUS_TYPE_OBJECT_PATH, &path);
+    sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sa{sv}}");
+    while (sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                          "sa{sv}") > 0) {
+      const char *interface = nullptr;
+      sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &interface);
+      if (std::strcmp(interface, value_interface) != 0) {
+        sd_bus_message_skip(m, "a{sv}");
+        sd_bus_message_exit_container(m);
+        continue;
+      }
+      sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+      while (sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY,
+                                            "sv") > 0) {
+        const char *name = nullptr;
+        double value = 0.0;
+        sd_bus_message_read_basic(m, SD_BUS_TYPE_STRING, &name);
+        if (std::strcmp(name, "Value") != 0) {
+          sd_bus_message_skip(m, "v");
+        } else if (sd_bus_message_read(m, "v", "d", &value) >= 0 &&
+                   !slot_of(path)) {
+          update(path, value);
+          seeded++;
+        }
+        sd_bus_message_exit_container(m);
+      }
+      sd_bus_message_exit_container(m);
+      sd_bus_message_exit_container(m);
+    }
+    sd_bus_message_exit_container(m);
+    sd_bus_message_exit_container(m);
+  }
+  std::cout << "Seeded the cache with " << seeded << " sensor values\n";
+}
+
+CacheStats SensorCache::take_stats() {
+  CacheStats stats;
+  stats.sensors = entries.size();
+  stats.updates = std::exchange(updates, 0);
+  stats.values_served = std::exchange(values_served, 0);
+  if (!entries.empty()) {
+    uint64_t oldest = std::min_element(entries.begin(), entries.end(),
+                                       [](const CacheEntry &a,
+                                          const CacheEntry &b) {
+                                         return a.updated_us < b.updated_us;
+                                       })
+                          ->updated_us;
+    stats.oldest = std::chrono::microseconds(steady_clock_us() - oldest);
+  }
+  return stats;
+}
+
+int SensorCache::find(sd_bus *, const char *path, const char *,
+                      void *userdata, void **found, sd_bus_error *) {
+  SensorCache *cache = static_cast<SensorCache *>(userdata);
+  if (!cache->slot_of(path)) {
+    return 0;
+  }
+  *found = cache;
+  return 1;
+}
+
+// sd-bus frees the list, so it has to come from malloc
+int SensorCache::enumerate(sd_bus *, const char *, void *userdata,
+                           char ***nodes, sd_bus_error *) {
+  SensorCache *cache = static_cast<SensorCache *>(userdata);
+  char **list = static_cast<char **>(
+      std::calloc(cache->paths.size() + 1, sizeof(char *)));
+  if (list == nullptr) {
+    return -ENOMEM;
+  }
+  size_t count = 0;
+  for (const std::string &path : cache->paths) {
+    list[count] = strdup(path.c_str());
+    if (list[count] == nullptr) {
+      break;
+    }
+    count++;
+  }
+  *nodes = list;
+  return 0;
+}
+
+int SensorCache::get_value(sd_bus *, const char *path, const char *,
+                           const char *, sd_bus_message *reply,
+                           void *userdata, sd_bus_error *) {
+  SensorCache *cache = static_cast<SensorCache *>(userdata);
+  std::optional<uint32_t> slot = cache->slot_of(path);
+  if (!slot) {
+    return -ENOENT;
+  }
+  cache->values_served++;
+  return sd_bus_message_append_basic(reply, SD_BUS_TYPE_DOUBLE,
+                                     &cache->entries[*slot].value);
+}
+
+int SensorCache::get_last_update(sd_bus *, const char *path, const char *,
+                                 const char *, sd_bus_message *reply,
+                                 void *userdata, sd_bus_error *) {
+  SensorCache *cache = static_cast<SensorCache *>(userdata);
+  std::optional<uint32_t> slot = cache->slot_of(path);
+  if (!slot) {
+    return -ENOENT;
+  }
+  return sd_bus_message_append_basic(reply, SD_BUS_TYPE_UINT64,
+                                     &cache->entries[*slot].updated_us);
+}
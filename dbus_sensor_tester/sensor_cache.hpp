@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sdbusplus/asio/connection.hpp>
+#include <string>
+#include <string_view>
+#include <systemd/sd-bus.h>
+#include <unordered_map>
+#include <vector>
+
+// Latest value of one sensor and when it arrived, in steady_clock
+// microseconds
+struct CacheEntry {
+  double value = std::numeric_limits<double>::quiet_NaN();
+  uint64_t updated_us = 0;
+};
+
+struct CacheStats {
+  size_t sensors = 0;
+  // Values taken from signals
+  size_t updates = 0;
+  // Values handed out by Get, GetAll and GetManagedObjects
+  size_t values_served = 0;
+  // Age of the least recently updated value
+  std::chrono::microseconds oldest{0};
+};
+
+// Keeps the latest Value of every sensor the watcher hears about and serves
+// it under a bus name of its own, with the same object paths and
+// Sensor.Value interface as the sensor daemon, so a client such as bmcweb
+// can be pointed at the cache instead.  Paths are interned once, the values
+// live in one flat table indexed by the interned path, and no objects are
+// registered per sensor: one fallback vtable answers for the whole sensor
+// tree and a node enumerator lists it for GetManagedObjects.
+class SensorCache {
+public:
+  explicit SensorCache(std::shared_ptr<sdbusplus::asio::connection> connection);
+  ~SensorCache();
+
+  SensorCache(const SensorCache &) = delete;
+  SensorCache &operator=(const SensorCache &) = delete;
+
+  // Starts serving as cache_service and seeds the table with the current
+  // values of source_service
+  void start(const std::string &cache_service,
+             const std::string &source_service);
+
+  // Only allocates the first time a path is seen
+  void update(std::string_view path, double value);
+
+  CacheStats take_stats();
+
+private:
+  std::optional<uint32_t> slot_of(std::string_view path) const;
+  uint32_t intern(std::string_view path);
+  void seed(sdbusplus::message_t &reply);
+
+  static int find(sd_bus *bus, const char *path, const char *interface,
+                  void *userdata, void **found, sd_bus_error *error);
+  static int enumerate(sd_bus *bus, const char *prefix, void *userdata,
+                       char ***nodes, sd_bus_error *error);
+  static int get_value(sd_bus *bus, const char *path, const char *interface,
+                       const char *property, sd_bus_message *reply,
+                       void *userdata, sd_bus_error *error);
+  static int get_last_update(sd_bus *bus, const char *path,
+                             const char *interface, const char *property,
+                             sd_bus_message *reply, void *userdata,
+                             sd_bus_error *error);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  std::vector<sd_bus_slot *> slots;
+
+  // deque, so the views in index stay valid as paths are added
+  std::deque<std::string> paths;
+  std::unordered_map<std::string_view, uint32_t> index;
+  std::vector<CacheEntry> entries;
+
+  size_t updates = 0;
+  size_t values_served = 0;
+};
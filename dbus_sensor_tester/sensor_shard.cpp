@@ -0,0 +1,475 @@
+#include "sensor_shard.hpp"
+
+#include "probe.hpp"
+
+#include <array>
+#include <functional>
+#include <iostream>
+#include <sdbusplus/vtable.hpp>
+#include <systemd/sd-bus.h>
+
+void UpdateStats::merge(const UpdateStats &other) {
+  updates += other.updates;
+  signals += other.signals;
+  unchanged += other.unchanged;
+  missed_deadlines += other.missed_deadlines;
+  longest_sweep = std::max(longest_sweep, other.longest_sweep);
+  latency.merge(other.latency);
+  schedule_lag.merge(other.schedule_lag);
+  snapshot_latency.merge(other.snapshot_latency);
+  filter.merge(other.filter);
+}
+
+// Registers a double property whose value is read from storage, so it can be
+// changed without emitting PropertiesChanged
+static void
+register_stored_property(sdbusplus::asio::dbus_interface &interface,
+                         const std::string &name, const double *storage) {
+  interface.register_property_r<double>(
+      name, *storage, sdbusplus::vtable::property_::emits_change,
+      [storage](const double &) { return *storage; });
+}
+
+// Same, but clients can Set it too
+static void
+register_writable_property(sdbusplus::asio::dbus_interface &interface,
+                           const std::string &name, double *storage) {
+  interface.register_property_rw<double>(
+      name, *storage, sdbusplus::vtable::property_::emits_change,
+      [storage](const double &request, double &old) {
+        *storage = request;
+        old = request;
+        return true;
+      },
+      [storage](const double &) { return *storage; });
+}
+
+std::chrono::steady_clock::duration RegistrationTimes::total() const {
+  return path + add_interface + register_properties + initialize;
+}
+
+void RegistrationTimes::merge(const RegistrationTimes &other) {
+  path += other.path;
+  add_interface += other.add_interface;
+  register_properties += other.register_properties;
+  initialize += other.initialize;
+}
+
+std::string RegistrationTimes::summary() const {
+  auto millis = [](std::chrono::steady_clock::duration duration) {
+    return std::to_string(
+               std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+                   .count()) +
+           "ms";
+  };
+  return "path " + millis(path) + ", add_interface " + millis(add_interface) +
+         ", properties " + millis(register_properties) + ", initialize " +
+         millis(initialize);
+}
+
+// Attributes the time since the previous lap to a registration phase
+class PhaseTimer {
+public:
+  void lap(std::chrono::steady_clock::duration &phase) {
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    phase += now - last;
+    last = now;
+  }
+
+private:
+  std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+};
+
+SensorShard::SensorShard(
+    std::shared_ptr<sdbusplus::asio::connection> connection,
+    const ShardConfig &config, size_t first_sensor, size_t sensor_count)
+    : connection(connection),
+      object_server(connection, config.announce != AnnounceMode::immediate),
+      timer(connection->get_io_context()), config(config) {
+  // initialize() always tries to emit InterfacesAdded, but sd-bus refuses
+  // without an ObjectManager above the path, which the deferred modes only
+  // add in announce().  initialize(true) also skips the PropertiesChanged
+  // for every property that would give the objects away.
+  bool silent = config.announce != AnnounceMode::immediate;
+  if (config.workload) {
+    random.seed(config.workload->seed ^ static_cast<uint32_t>(first_sensor));
+  }
+  sensors.reserve(sensor_count);
+  PhaseTimer phase;
+  for (size_t sensorIndex = first_sensor;
+       sensorIndex < first_sensor + sensor_count; sensorIndex++) {
+    Sensor &sensor = sensors.emplace_back();
+    sensor.index = sensorIndex;
+    std::string type = "temperature";
+    std::string name = "foobar";
+    std::string unit = "xyz.openbmc_project.Sensor.Value.Unit.DegreesC";
+    if (config.workload) {
+      sensor.sensor_class = &config.workload->class_of(sensorIndex);
+      type = sensor.sensor_class->type;
+      name = sensor.sensor_class->name;
+      unit = sensor.sensor_class->unit;
+    }
+    // Built as a plain string, object_path would escape the _ in names
+    std::string path = "/xyz/openbmc_project/sensors/" + type + "/" + name +
+                       std::to_string(sensorIndex);
+    const SensorValues &values = sensor.values;
+    phase.lap(registration.path);
+
+    sensor.value_interface =
+        object_server.add_interface(path, "xyz.openbmc_project.Sensor.Value");
+    phase.lap(registration.add_interface);
+    sensor.value_interface->register_property<std::string>("Unit", unit);
+    if (config.all_properties) {
+      register_stored_property(*sensor.value_interface, "MaxValue",
+                               &values.max_value);
+      register_stored_property(*sensor.value_interface, "MinValue",
+                               &values.min_value);
+      if (config.writable) {
+        register_writable_property(*sensor.value_interface, "Value",
+                                   &sensor.values.value);
+      } else {
+        register_stored_property(*sensor.value_interface, "Value",
+                                 &values.value);
+      }
+    } else {
+      sensor.value_interface->register_property<double>("MaxValue", 100);
+      sensor.value_interface->register_property<double>("MinValue", -100);
+      sensor.value_interface->register_property<double>(
+          "Value", 42,
+          config.writable ? sdbusplus::asio::PropertyPermission::readWrite
+                          : sdbusplus::asio::PropertyPermission::readOnly);
+    }
+    phase.lap(registration.register_properties);
+    sensor.value_interface->initialize(silent);
+    phase.lap(registration.initialize);
+
+    if (!config.thresholds) {
+      continue;
+    }
+    sensor.warning_interface = object_server.add_interface(
+        path, "xyz.openbmc_project.Sensor.Threshold.Warning");
+    sensor.critical_interface = object_server.add_interface(
+        path, "xyz.openbmc_project.Sensor.Threshold.Critical");
+    phase.lap(registration.add_interface);
+    register_stored_property(*sensor.warning_interface, "WarningHigh",
+                             &values.warning_high);
+    register_stored_property(*sensor.warning_interface, "WarningLow",
+                             &values.warning_low);
+    register_stored_property(*sensor.critical_interface, "CriticalHigh",
+                             &values.critical_high);
+    register_stored_property(*sensor.critical_interface, "CriticalLow",
+                             &values.critical_low);
+    phase.lap(registration.register_properties);
+    sensor.warning_interface->initialize(silent);
+    sensor.critical_interface->initialize(silent);
+    phase.lap(registration.initialize);
+  }
+}
+
+void SensorShard::announce() {
+  if (config.announce != AnnounceMode::immediate) {
+    object_server.add_manager("/");
+  }
+  if (config.announce == AnnounceMode::per_path) {
+    for (Sensor &sensor : sensors) {
+      std::array<char *, 4> names{};
+      size_t count = 0;
+      for (auto &interface : {sensor.value_interface, sensor.warning_interface,
+                              sensor.critical_interface}) {
+        if (interface) {
+          names[count++] =
+              const_cast<char *>(interface->get_interface_name().c_str());
+        }
+      }
+      int r = sd_bus_emit_interfaces_added_strv(
+          connection->get(),
+          sensor.value_interface->get_object_path().c_str(), names.data());
+      if (r < 0) {
+        std::cout << "Can't emit interfaces added for sensor\n";
+      }
+    }
+  }
+  connection->flush();
+}
+
+std::string SensorShard::last_path() const {
+  if (sensors.empty()) {
+    return {};
+  }
+  return sensors.back().value_interface->get_object_path();
+}
+
+std::chrono::steady_clock::time_point
+SensorShard::with_jitter(std::chrono::steady_clock::time_point nominal,
+                         const SensorClass &sensor_class) {
+  if (sensor_class.jitter.count() == 0) {
+    return nominal;
+  }
+  std::uniform_int_distribution<std::chrono::steady_clock::rep> offset(
+      -sensor_class.jitter.count(), sensor_class.jitter.count());
+  return nominal + std::chrono::steady_clock::duration(offset(random));
+}
+
+void SensorShard::start() {
+  if (sensors.empty()) {
+    return;
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (config.workload) {
+    // Every sensor starts at a random phase of its period, real daemons
+    // don't poll in lockstep
+    for (size_t index = 0; index < sensors.size(); index++) {
+      const SensorClass &sensor_class = *sensors[index].sensor_class;
+      std::uniform_int_distribution<std::chrono::steady_clock::rep> phase(
+          0, sensor_class.period.count());
+      Poll poll;
+      poll.nominal = now + std::chrono::steady_clock::duration(phase(random));
+      poll.due = with_jitter(poll.nominal, sensor_class);
+      poll.sensor = index;
+      polls.push(poll);
+    }
+    next_deadline = polls.top().due;
+  } else {
+    next_deadline = now + config.update_interval;
+  }
+  timer.expires_at(next_deadline);
+  timer.async_wait(std::bind_front(&SensorShard::on_loop, this));
+}
+
+UpdateStats SensorShard::take_stats() {
+  std::lock_guard lock(stats_mutex);
+  return std::exchange(stats, UpdateStats());
+}
+
+// Accounts for how late an update started against its schedule
+static void record_schedule(std::chrono::steady_clock::time_point deadline,
+                            std::chrono::steady_clock::duration period,
+                            UpdateStats &updates) {
+  std::chrono::steady_clock::duration lag =
+      std::chrono::steady_clock::now() - deadline;
+  updates.schedule_lag.record(lag);
+  if (lag > period) {
+    updates.missed_deadlines++;
+  }
+}
+
+void SensorShard::publish(Sensor &sensor, double new_value,
+                          UpdateStats &updates) {
+  if (config.end_to_end) {
+    new_value = Probe::now(sensor.published).encode();
+  }
+  // Shared memory goes first, so neither path's latency includes the other
+  if (config.snapshot) {
+    std::chrono::steady_clock::time_point snapshot_start =
+        std::chrono::steady_clock::now();
+    config.snapshot->publish(sensor.index, new_value);
+    updates.snapshot_latency.record(std::chrono::steady_clock::now() -
+                                    snapshot_start);
+  }
+  std::chrono::steady_clock::time_point update_start =
+      std::chrono::steady_clock::now();
+  if (config.all_properties) {
+    updates.signals += publish_all_properties(sensor, new_value);
+  } else if (!sensor.value_interface->set_property("Value", new_value)) {
+    std::cout << "Can't set property for sensor\n";
+  } else {
+    updates.signals++;
+  }
+  sensor.published++;
+  updates.latency.record(std::chrono::steady_clock::now() - update_start);
+  updates.updates++;
+}
+
+void SensorShard::update_sensor(size_t index,
+                                std::chrono::steady_clock::time_point deadline,
+                                std::chrono::steady_clock::duration period,
+                                UpdateStats &updates) {
+  record_schedule(deadline, period, updates);
+  if (config.noise) {
+    filtered_update(sensors[index], updates);
+    return;
+  }
+  publish(sensors[index], value, updates);
+  value += 10.0;
+  if (value >= 100.0) {
+    value = -100.0;
+  }
+}
+
+// Takes the next reading of the noise model and publishes it if it gets
+// through the deadband
+void SensorShard::filtered_update(Sensor &sensor, UpdateStats &updates) {
+  DeadbandState &state = sensor.filter;
+  double reading = config.noise->read(sensor.index, state.polls++,
+                                      state.truth);
+  FilterDecision decision = config.deadband.apply(state, reading);
+  updates.filter.record(decision, state, reading);
+  if (decision == FilterDecision::publish) {
+    publish(sensor, reading, updates);
+  } else if (decision == FilterDecision::unchanged) {
+    updates.unchanged++;
+  }
+}
+
+// Emits a PropertiesChanged for the given properties of one interface
+static bool emit_properties_changed(sdbusplus::asio::connection &connection,
+                                    sdbusplus::asio::dbus_interface &interface,
+                                    const char *const *names) {
+  int r = sd_bus_emit_properties_changed_strv(
+      connection.get(), interface.get_object_path().c_str(),
+      interface.get_interface_name().c_str(), const_cast<char **>(names));
+  return r >= 0;
+}
+
+// Moves every stored property along with the new value, and returns the
+// number of signals it took to announce them
+size_t SensorShard::publish_all_properties(Sensor &sensor, double new_value) {
+  SensorValues &values = sensor.values;
+  values.value = new_value;
+  values.max_value = new_value + 100.0;
+  values.min_value = new_value - 100.0;
+  values.warning_high = new_value + 20.0;
+  values.warning_low = new_value - 20.0;
+  values.critical_high = new_value + 30.0;
+  values.critical_low = new_value - 30.0;
+
+  static constexpr std::array<const char *, 4> value_names = {
+      "Value", "MaxValue", "MinValue", nullptr};
+  static constexpr std::array<const char *, 3> warning_names = {
+      "WarningHigh", "WarningLow", nullptr};
+  static constexpr std::array<const char *, 3> critical_names = {
+      "CriticalHigh", "CriticalLow", nullptr};
+
+  std::array<std::pair<sdbusplus::asio::dbus_interface *, const char *const *>,
+             3>
+      interfaces = {{{sensor.value_interface.get(), value_names.data()},
+                     {sensor.warning_interface.get(), warning_names.data()},
+                     {sensor.critical_interface.get(), critical_names.data()}}};
+
+  size_t signals = 0;
+  for (auto [interface, names] : interfaces) {
+    if (interface == nullptr) {
+      continue;
+    }
+    if (config.batch_properties) {
+      if (!emit_properties_changed(*connection, *interface, names)) {
+        std::cout << "Can't emit properties changed for sensor\n";
+        continue;
+      }
+      signals++;
+      continue;
+    }
+    for (const char *const *name = names; *name != nullptr; name++) {
+      if (!interface->signal_property(*name)) {
+        std::cout << "Can't signal property for sensor\n";
+        continue;
+      }
+      signals++;
+    }
+  }
+  return signals;
+}
+
+void SensorShard::sweep() {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  UpdateStats sweep;
+  for (size_t index = 0; index < sensors.size(); index++) {
+    update_sensor(index, next_deadline, config.update_interval, sweep);
+  }
+  sweep.longest_sweep = std::chrono::steady_clock::now() - start;
+  next_deadline += config.update_interval;
+
+  std::lock_guard lock(stats_mutex);
+  stats.merge(sweep);
+}
+
+void SensorShard::paced_updates() {
+  std::chrono::steady_clock::duration period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(1.0 / config.update_rate));
+
+  // Catch up on every update that is due, but at most one pass over the
+  // sensors before returning to the io_context so incoming messages on the
+  // connection are still serviced when the shard falls behind.
+  UpdateStats batch;
+  for (size_t budget = sensors.size();
+       budget > 0 && next_deadline <= std::chrono::steady_clock::now();
+       budget--) {
+    update_sensor(next_sensor, next_deadline, period, batch);
+    next_deadline += period;
+    if (++next_sensor == sensors.size()) {
+      next_sensor = 0;
+    }
+  }
+
+  std::lock_guard lock(stats_mutex);
+  stats.merge(batch);
+}
+
+void SensorShard::workload_polls() {
+  // Same catch up limit as paced_updates
+  UpdateStats batch;
+  for (size_t budget = sensors.size();
+       budget > 0 && polls.top().due <= std::chrono::steady_clock::now();
+       budget--) {
+    Poll poll = polls.top();
+    polls.pop();
+    Sensor &sensor = sensors[poll.sensor];
+    const SensorClass &sensor_class = *sensor.sensor_class;
+
+    record_schedule(poll.due, sensor_class.period, batch);
+    // Like a real sensor daemon, only publish values that changed
+    if (config.noise) {
+      filtered_update(sensor, batch);
+    } else if (std::bernoulli_distribution(sensor_class.change_probability)(
+                   random)) {
+      sensor.reading += std::uniform_real_distribution(-1.0, 1.0)(random);
+      publish(sensor, sensor.reading, batch);
+    } else {
+      batch.unchanged++;
+    }
+
+    poll.nominal += sensor_class.period;
+    poll.due = with_jitter(poll.nominal, sensor_class);
+    polls.push(poll);
+  }
+  next_deadline = polls.top().due;
+
+  std::lock_guard lock(stats_mutex);
+  stats.merge(batch);
+}
+
+void SensorShard::on_loop(const boost::system::error_code &error) {
+  if (error) {
+    return;
+  }
+
+  if (config.workload) {
+    workload_polls();
+  } else if (config.update_rate > 0.0) {
+    paced_updates();
+  } else {
+    sweep();
+  }
+
+  // A deadline already in the past fires right away, which keeps the offered
+  // load constant while the shard catches up
+  timer.expires_at(next_deadline);
+  timer.async_wait(std::bind_front(&SensorShard::on_loop, this));
+}
+
+std::shared_ptr<sdbusplus::asio::connection>
+open_connection(boost::asio::io_context &io) {
+  sd_bus *bus = nullptr;
+  int r = sd_bus_open(&bus);
+  if (r < 0) {
+    throw sdbusplus::exception::SdBusError(-r, "sd_bus_open");
+  }
+  // The connection takes its own reference
+  auto connection = std::make_shared<sdbusplus::asio::connection>(io, bus);
+  sd_bus_unref(bus);
+  return connection;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "deadband.hpp"
+#include "histogram.hpp"
+#include "shm_snapshot.hpp"
+#include "workload.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sdbusplus/asio/connection.hpp>
+#include <sdbusplus/asio/object_server.hpp>
+#include <string>
+#include <vector>
+
+// Update statistics of one shard, collected and merged by the reporter
+struct UpdateStats {
+  size_t updates = 0;
+  // PropertiesChanged signals emitted for those updates
+  size_t signals = 0;
+  // Workload or noise model polls that found the value unchanged and
+  // published nothing
+  size_t unchanged = 0;
+  // Updates issued after the following update was already due
+  size_t missed_deadlines = 0;
+  std::chrono::steady_clock::duration longest_sweep{};
+  Histogram latency;
+  // How late each update started relative to its scheduled time
+  Histogram schedule_lag;
+  // Time spent writing values into the shared memory snapshot
+  Histogram snapshot_latency;
+  // Readings of the noise model and what the deadband did with them
+  FilterStats filter;
+
+  void merge(const UpdateStats &other);
+};
+
+// How registered sensors are announced to the rest of the bus
+enum class AnnounceMode {
+  // initialize() emits InterfacesAdded for every interface as it goes
+  immediate,
+  // Register before the ObjectManager exists, so initialize() has nothing
+  // to emit, then one InterfacesAdded per object for all of its interfaces
+  // once every sensor is registered
+  per_path,
+  // Registered the same way, but no InterfacesAdded at all, the bus name is
+  // only claimed after registration so consumers pick up the tree with one
+  // GetManagedObjects
+  name_owner,
+};
+
+// Updates are scheduled against absolute deadlines, so a slow bus shows up
+// as missed deadlines and schedule lag instead of silently lowering the
+// offered load.  Without a rate every sensor is updated in one sweep each
+// update_interval, with a rate the updates are paced evenly, and with a
+// workload every sensor follows the timing of its class.
+struct ShardConfig {
+  std::chrono::steady_clock::duration update_interval = std::chrono::seconds(1);
+  // Sensor updates per second for this shard, 0 to sweep every interval
+  double update_rate = 0.0;
+  // Publish probes instead of sawtooth values
+  bool end_to_end = false;
+  // Change MaxValue, MinValue and the thresholds along with Value
+  bool all_properties = false;
+  // Coalesce all_properties changes into one signal per interface
+  bool batch_properties = false;
+  // Add Threshold.Warning and Threshold.Critical interfaces to every sensor
+  bool thresholds = false;
+  // Let clients Set Value, as --pipeline set does
+  bool writable = false;
+  AnnounceMode announce = AnnounceMode::immediate;
+  // Sensor types and timing from a profile instead of lockstep temperatures
+  std::shared_ptr<const Workload> workload;
+  // Also publish every value here, ahead of the D-Bus property
+  std::shared_ptr<ShmSnapshot> snapshot;
+  // Values come from the noise model and go through the deadband instead
+  // of the sawtooth or the workload's random walk
+  std::shared_ptr<const NoiseModel> noise;
+  Deadband deadband;
+};
+
+// Property values served by the multi property modes, so several of them can
+// change before any signal is emitted
+struct SensorValues {
+  double value = 42;
+  double max_value = 100;
+  double min_value = -100;
+  double warning_high = 80;
+  double warning_low = -80;
+  double critical_high = 90;
+  double critical_low = -90;
+};
+
+struct Sensor {
+  std::shared_ptr<sdbusplus::asio::dbus_interface> value_interface;
+  std::shared_ptr<sdbusplus::asio::dbus_interface> warning_interface;
+  std::shared_ptr<sdbusplus::asio::dbus_interface> critical_interface;
+  SensorValues values;
+  // Workload class, or null for the default temperature sensors
+  const SensorClass *sensor_class = nullptr;
+  // Random walk of a workload sensor, kept apart from any probe encoding
+  double reading = 42;
+  // Number of values published, the sequence number of end to end probes
+  uint64_t published = 0;
+  // Across all shards, the sensor's slot in the snapshot and its noise
+  size_t index = 0;
+  DeadbandState filter;
+};
+
+// Next poll of a workload sensor; due is the nominal time moved by jitter
+struct Poll {
+  std::chrono::steady_clock::time_point nominal;
+  std::chrono::steady_clock::time_point due;
+  size_t sensor = 0;
+
+  bool operator>(const Poll &other) const { return due > other.due; }
+};
+
+// Time spent in each phase of registering a shard's sensors
+struct RegistrationTimes {
+  std::chrono::steady_clock::duration path{};
+  std::chrono::steady_clock::duration add_interface{};
+  std::chrono::steady_clock::duration register_properties{};
+  // initialize() registers the vtable and, when announcing immediately,
+  // queues InterfacesAdded
+  std::chrono::steady_clock::duration initialize{};
+
+  std::chrono::steady_clock::duration total() const;
+  void merge(const RegistrationTimes &other);
+  std::string summary() const;
+};
+
+// A slice of the sensors, owned by one connection and updated from the
+// io_context of that connection.  Statistics are kept under a mutex so the
+// reporter can collect them from another thread.
+class SensorShard {
+public:
+  SensorShard(std::shared_ptr<sdbusplus::asio::connection> connection,
+              const ShardConfig &config, size_t first_sensor,
+              size_t sensor_count);
+
+  // Adds the ObjectManager of the deferred modes, sends their
+  // announcements, if any, and flushes the connection
+  void announce();
+  void start();
+  UpdateStats take_stats();
+  std::string last_path() const;
+  const RegistrationTimes &registration_times() const { return registration; }
+
+private:
+  void on_loop(const boost::system::error_code &error);
+  void sweep();
+  void paced_updates();
+  void workload_polls();
+  void update_sensor(size_t index,
+                     std::chrono::steady_clock::time_point deadline,
+                     std::chrono::steady_clock::duration period,
+                     UpdateStats &updates);
+  void publish(Sensor &sensor, double new_value, UpdateStats &updates);
+  void filtered_update(Sensor &sensor, UpdateStats &updates);
+  size_t publish_all_properties(Sensor &sensor, double new_value);
+  std::chrono::steady_clock::time_point with_jitter(
+      std::chrono::steady_clock::time_point nominal,
+      const SensorClass &sensor_class);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  sdbusplus::asio::object_server object_server;
+  // Reserved up front and never resized, property getters point into it
+  std::vector<Sensor> sensors;
+  boost::asio::steady_timer timer;
+  ShardConfig config;
+  RegistrationTimes registration;
+
+  std::chrono::steady_clock::time_point next_deadline;
+  size_t next_sensor = 0;
+
+  std::priority_queue<Poll, std::vector<Poll>, std::greater<>> polls;
+  std::mt19937 random;
+
+  double value = -100.0;
+
+  std::mutex stats_mutex;
+  UpdateStats stats;
+};
+
+// Opens a new, unshared connection to the default bus, serviced by io
+std::shared_ptr<sdbusplus::asio::connection>
+open_connection(boost::asio::io_context &io);
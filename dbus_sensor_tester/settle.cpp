@@ -0,0 +1,146 @@
+#include "settle.hpp"
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <systemd/sd-bus.h>
+#include <vector>
+
+// InterfacesAdded is sent on the ObjectManager's path, the object is the
+// first argument
+static constexpr const char *interfaces_added_rule =
+    "type='signal',interface='org.freedesktop.DBus.ObjectManager',"
+    "member='InterfacesAdded',arg0path='/xyz/openbmc_project/sensors/'";
+
+static constexpr std::chrono::milliseconds mapper_poll_interval(10);
+static constexpr std::chrono::seconds mapper_timeout(60);
+
+SettleMonitor::SettleMonitor(
+    std::shared_ptr<sdbusplus::asio::connection> connection,
+    std::string last_path, std::chrono::steady_clock::time_point start)
+    : connection(connection), last_path(std::move(last_path)), start(start),
+      retry_timer(connection->get_io_context()) {}
+
+void SettleMonitor::begin() {
+  sdbusplus::message_t ping = connection->new_method_call(
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      "GetId");
+  connection->async_send(
+      ping, std::bind_front(&SettleMonitor::on_broker_reply, this));
+}
+
+void SettleMonitor::report(const std::string &what) {
+  std::cout << what << " "
+            << std::chrono::duration_cast<std::chrono::duration<float>>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " seconds after registration started\n";
+}
+
+void SettleMonitor::on_broker_reply(const boost::system::error_code &error,
+                                    sdbusplus::message_t) {
+  if (error) {
+    std::cerr << "Broker round trip failed: " << error.message() << "\n";
+  } else {
+    report("Broker answered");
+  }
+  if (!last_path.empty()) {
+    query_mapper();
+  }
+}
+
+void SettleMonitor::query_mapper() {
+  sdbusplus::message_t call = connection->new_method_call(
+      "xyz.openbmc_project.ObjectMapper", "/xyz/openbmc_project/object_mapper",
+      "xyz.openbmc_project.ObjectMapper", "GetObject");
+  call.append(last_path, std::vector<std::string>());
+  connection->async_send(
+      call, std::bind_front(&SettleMonitor::on_mapper_reply, this));
+}
+
+void SettleMonitor::on_mapper_reply(const boost::system::error_code &error,
+                                    sdbusplus::message_t reply) {
+  if (!error && !reply.is_method_error()) {
+    report("Mapper resolved " + last_path);
+    return;
+  }
+  const sd_bus_error *bus_error = sd_bus_message_get_error(reply.get());
+  if (bus_error != nullptr && bus_error->name != nullptr &&
+      std::strcmp(bus_error->name,
+                  "org.freedesktop.DBus.Error.ServiceUnknown") == 0) {
+    std::cout << "No object mapper on the bus, not waiting for it\n";
+    return;
+  }
+  if (std::chrono::steady_clock::now() - start > mapper_timeout) {
+    std::cerr << "Mapper did not resolve " << last_path << " in time\n";
+    return;
+  }
+  retry_timer.expires_from_now(mapper_poll_interval);
+  retry_timer.async_wait([this](const boost::system::error_code &ec) {
+    if (!ec) {
+      query_mapper();
+    }
+  });
+}
+
+AnnounceCounter::AnnounceCounter(
+    std::shared_ptr<sdbusplus::asio::connection> connection)
+    : connection(connection),
+      match(static_cast<sdbusplus::bus_t &>(*connection),
+            interfaces_added_rule,
+            std::bind_front(&AnnounceCounter::on_signal, this)) {}
+
+void AnnounceCounter::on_signal(sdbusplus::message_t &message) {
+  sd_bus_message *m = message.get();
+  const char *path = nullptr;
+  if (sd_bus_message_read(m, "o", &path) < 0 ||
+      sd_bus_message_enter_container(m, 'a', "{sa{sv}}") < 0) {
+    std::cerr << "Malformed InterfacesAdded\n";
+    return;
+  }
+  while (sd_bus_message_skip(m, "{sa{sv}}") > 0) {
+    interfaces_seen++;
+  }
+  paths.emplace(path);
+  signals++;
+}
+
+void AnnounceCounter::check(AnnounceMode mode, size_t objects,
+                            size_t interfaces) {
+  this->mode = mode;
+  this->objects = objects;
+  this->interfaces = interfaces;
+  sdbusplus::message_t ping = connection->new_method_call(
+      "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+      "GetId");
+  connection->async_send(
+      ping, std::bind_front(&AnnounceCounter::on_broker_reply, this));
+}
+
+void AnnounceCounter::on_broker_reply(const boost::system::error_code &error,
+                                      sdbusplus::message_t) {
+  if (error) {
+    std::cerr << "Broker round trip failed: " << error.message() << "\n";
+    return;
+  }
+  bool expected = false;
+  switch (mode) {
+  case AnnounceMode::immediate:
+    expected = signals == objects * interfaces && paths.size() == objects &&
+               interfaces_seen == signals;
+    break;
+  case AnnounceMode::per_path:
+    expected = signals == objects && paths.size() == objects &&
+               interfaces_seen == objects * interfaces;
+    break;
+  case AnnounceMode::name_owner:
+    expected = signals == 0;
+    break;
+  }
+  std::cout << "Saw " << signals << " InterfacesAdded for " << paths.size()
+            << " of " << objects << " objects, " << interfaces_seen
+            << " interfaces\n";
+  if (!expected) {
+    std::cerr << "That is not what the announce mode should send\n";
+  }
+}
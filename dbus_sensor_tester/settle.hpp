@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sensor_shard.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <memory>
+#include <sdbusplus/asio/connection.hpp>
+#include <sdbusplus/bus/match.hpp>
+#include <string>
+#include <unordered_set>
+
+// Measures how long the rest of the bus takes to catch up after sensors are
+// announced: a round trip through the broker, and the object mapper
+// resolving the last announced path (skipped when no mapper is running).
+// Times are reported relative to start, normally the start of registration.
+class SettleMonitor {
+public:
+  SettleMonitor(std::shared_ptr<sdbusplus::asio::connection> connection,
+                std::string last_path,
+                std::chrono::steady_clock::time_point start);
+
+  void begin();
+
+private:
+  void on_broker_reply(const boost::system::error_code &error,
+                       sdbusplus::message_t reply);
+  void query_mapper();
+  void on_mapper_reply(const boost::system::error_code &error,
+                       sdbusplus::message_t reply);
+  void report(const std::string &what);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  std::string last_path;
+  std::chrono::steady_clock::time_point start;
+  boost::asio::steady_timer retry_timer;
+};
+
+// Counts the InterfacesAdded signals for sensors on a connection of its
+// own, created before registration, so --settle can check that the announce
+// mode sent what it promises: one signal per interface when immediate, one
+// per object for per-path and none for name-owner.
+class AnnounceCounter {
+public:
+  explicit AnnounceCounter(
+      std::shared_ptr<sdbusplus::asio::connection> connection);
+
+  // Checks the count after a round trip through the broker, once the
+  // announcements of objects sensors with interfaces each are flushed
+  void check(AnnounceMode mode, size_t objects, size_t interfaces);
+
+private:
+  void on_signal(sdbusplus::message_t &message);
+  void on_broker_reply(const boost::system::error_code &error,
+                       sdbusplus::message_t reply);
+
+  std::shared_ptr<sdbusplus::asio::connection> connection;
+  sdbusplus::bus::match_t match;
+  std::unordered_set<std::string> paths;
+  size_t signals = 0;
+  size_t interfaces_seen = 0;
+
+  AnnounceMode mode = AnnounceMode::immediate;
+  size_t objects = 0;
+  size_t interfaces = 0;
+};
@@ -0,0 +1,260 @@
+#include "shm_snapshot.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <utility>
+
+static constexpr uint32_t snapshot_magic = 0x534e5350; // "SNSP"
+static constexpr uint32_t snapshot_version = 1;
+
+static uint64_t steady_clock_ns() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// shm_open wants a single leading slash
+static std::string shm_name(const std::string &name) {
+  return name.starts_with('/') ? name : "/" + name;
+}
+
+static size_t snapshot_size(size_t sensor_count) {
+  return sizeof(SnapshotHeader) + sensor_count * sizeof(SnapshotSlot);
+}
+
+ShmSnapshot::ShmSnapshot(std::string name, void *mapping, size_t size,
+                         bool owner)
+    : name(std::move(name)), mapping(mapping), size(size), owner(owner),
+      header(static_cast<SnapshotHeader *>(mapping)),
+      slots(reinterpret_cast<SnapshotSlot *>(header + 1)) {}
+
+std::unique_ptr<ShmSnapshot> ShmSnapshot::create(const std::string &name,
+                                                 size_t sensor_count) {
+  std::string path = shm_name(name);
+  int fd = shm_open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Can't create shared memory " << path << ": "
+              << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+  size_t size = snapshot_size(sensor_count);
+  void *mapping = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Can't map shared memory " << path << ": "
+              << std::strerror(error) << "\n";
+    shm_unlink(path.c_str());
+    return nullptr;
+  }
+
+  // The magic goes in last, a reader that opens the region before then
+  // turns it down instead of seeing a half built header
+  SnapshotHeader *header = new (mapping) SnapshotHeader{};
+  header->sensor_count = sensor_count;
+  header->version = snapshot_version;
+  std::uninitialized_value_construct_n(
+      reinterpret_cast<SnapshotSlot *>(header + 1), sensor_count);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = snapshot_magic;
+  return std::unique_ptr<ShmSnapshot>(
+      new ShmSnapshot(path, mapping, size, true));
+}
+
+std::unique_ptr<ShmSnapshot> ShmSnapshot::open(const std::string &name) {
+  std::string path = shm_name(name);
+  int fd = shm_open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    std::cerr << "Can't open shared memory " << path << ": "
+              << std::strerror(errno) << "\n";
+    return nullptr;
+  }
+  struct stat status {};
+  void *mapping = MAP_FAILED;
+  size_t size = 0;
+  if (fstat(fd, &status) == 0) {
+    size = static_cast<size_t>(status.st_size);
+  }
+  if (size >= sizeof(SnapshotHeader)) {
+    mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cerr << path << " is not a sensor snapshot\n";
+    return nullptr;
+  }
+
+  const SnapshotHeader *header = static_cast<const SnapshotHeader *>(mapping);
+  if (header->magic != snapshot_magic ||
+      header->version != snapshot_version ||
+      size < snapshot_size(header->sensor_count)) {
+    std::cerr << path << " is not a sensor snapshot, or not finished yet\n";
+    munmap(mapping, size);
+    return nullptr;
+  }
+  return std::unique_ptr<ShmSnapshot>(
+      new ShmSnapshot(path, mapping, size, false));
+}
+
+ShmSnapshot::~ShmSnapshot() {
+  munmap(mapping, size);
+  if (owner) {
+    shm_unlink(name.c_str());
+  }
+}
+
+void ShmSnapshot::publish(size_t index, double value) {
+  SnapshotSlot &slot = slots[index];
+  uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.value.store(value, std::memory_order_relaxed);
+  slot.published_ns.store(steady_clock_ns(), std::memory_order_relaxed);
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+  header->generation.fetch_add(1, std::memory_order_release);
+}
+
+size_t ShmSnapshot::read(size_t index, SnapshotValue &out) const {
+  const SnapshotSlot &slot = slots[index];
+  size_t retries = 0;
+  while (true) {
+    uint32_t before = slot.sequence.load(std::memory_order_acquire);
+    if ((before & 1) == 0) {
+      out.value = slot.value.load(std::memory_order_relaxed);
+      out.published_ns = slot.published_ns.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) == before) {
+        out.sequence = before;
+        return retries;
+      }
+    }
+    retries++;
+  }
+}
+
+uint64_t ShmSnapshot::generation() const {
+  return header->generation.load(std::memory_order_acquire);
+}
+
+double PollStats::cpu_percent() const {
+  if (wall.count() <= 0) {
+    return 0.0;
+  }
+  return 100.0 * std::chrono::duration<double>(cpu).count() /
+         std::chrono::duration<double>(wall).count();
+}
+
+void PollStats::merge(const PollStats &other) {
+  polls += other.polls;
+  idle_polls += other.idle_polls;
+  values += other.values;
+  overwritten += other.overwritten;
+  retries += other.retries;
+  cpu += other.cpu;
+  wall += other.wall;
+  latency.merge(other.latency);
+}
+
+ShmPoller::ShmPoller(std::unique_ptr<ShmSnapshot> snapshot,
+                     std::chrono::microseconds interval)
+    : snapshot(std::move(snapshot)), interval(interval),
+      last_sequence(this->snapshot->sensor_count(), 0) {}
+
+ShmPoller::~ShmPoller() {
+  running = false;
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+// Whatever was published before the poller started is not a latency sample
+void ShmPoller::start() {
+  last_generation = snapshot->generation();
+  for (size_t index = 0; index < last_sequence.size(); index++) {
+    SnapshotValue value;
+    snapshot->read(index, value);
+    last_sequence[index] = value.sequence;
+  }
+  stats_start = std::chrono::steady_clock::now();
+  running = true;
+  thread = std::thread(&ShmPoller::run, this);
+}
+
+// The thread's CPU clock can be read from any thread, so the poller itself
+// doesn't pay for it
+static std::chrono::nanoseconds thread_cpu(std::thread &thread) {
+  clockid_t clock = 0;
+  timespec time{};
+  if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0 ||
+      clock_gettime(clock, &time) != 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::seconds(time.tv_sec) +
+         std::chrono::nanoseconds(time.tv_nsec);
+}
+
+PollStats ShmPoller::take_stats() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds cpu = thread_cpu(thread);
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  PollStats taken = std::exchange(stats, PollStats());
+  taken.wall = now - std::exchange(stats_start, now);
+  taken.cpu = cpu - std::exchange(last_cpu, cpu);
+  return taken;
+}
+
+void ShmPoller::run() {
+  std::chrono::steady_clock::time_point next =
+      std::chrono::steady_clock::now();
+  while (running.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      poll(stats);
+    }
+    if (interval.count() == 0) {
+      continue;
+    }
+    // A poller that fell behind starts over instead of polling back to back
+    next = std::max(next + interval, std::chrono::steady_clock::now());
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void ShmPoller::poll(PollStats &interval_stats) {
+  interval_stats.polls++;
+  uint64_t generation = snapshot->generation();
+  if (generation == last_generation) {
+    interval_stats.idle_polls++;
+    return;
+  }
+  last_generation = generation;
+  for (size_t index = 0; index < last_sequence.size(); index++) {
+    SnapshotValue value;
+    interval_stats.retries += snapshot->read(index, value);
+    if (value.sequence == last_sequence[index]) {
+      continue;
+    }
+    // Every publish moves the sequence on by two
+    interval_stats.overwritten += (value.sequence - last_sequence[index]) / 2 -
+                                  1;
+    last_sequence[index] = value.sequence;
+    interval_stats.values++;
+    interval_stats.latency.record(
+        std::chrono::nanoseconds(steady_clock_ns() - value.published_ns));
+  }
+}
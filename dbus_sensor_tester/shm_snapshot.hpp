@@ -0,0 +1,129 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One sensor in the snapshot, on a cache line of its own so publishing a
+// sensor does not bounce the lines of its neighbours between cores.  The
+// sequence is a seqlock: odd while the writer is in the middle of an update,
+// a reader retries if it was odd or changed while it read the value.
+struct alignas(64) SnapshotSlot {
+  std::atomic<uint32_t> sequence;
+  std::atomic<double> value;
+  // steady_clock, which is CLOCK_MONOTONIC and so the same in every process
+  std::atomic<uint64_t> published_ns;
+};
+
+struct alignas(64) SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sensor_count;
+  // Bumped after every publish, so a reader with nothing new to look at
+  // gets away with one load
+  std::atomic<uint64_t> generation;
+};
+
+static_assert(std::atomic<double>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "The snapshot is shared between processes, its atomics can't "
+              "take a lock");
+
+struct SnapshotValue {
+  double value = 0.0;
+  uint64_t published_ns = 0;
+  uint32_t sequence = 0;
+};
+
+// The values of every sensor in a shm_open region, published next to the
+// D-Bus properties to see what a shared memory fast path would save.  There
+// is a single writer, the shards only publish their own sensors' slots.
+class ShmSnapshot {
+public:
+  // Creates /dev/shm/<name> for sensor_count sensors, replacing any old one,
+  // and removes it again when destroyed
+  static std::unique_ptr<ShmSnapshot> create(const std::string &name,
+                                             size_t sensor_count);
+  // Maps an existing snapshot read only
+  static std::unique_ptr<ShmSnapshot> open(const std::string &name);
+  ~ShmSnapshot();
+
+  ShmSnapshot(const ShmSnapshot &) = delete;
+  ShmSnapshot &operator=(const ShmSnapshot &) = delete;
+
+  void publish(size_t index, double value);
+  // Returns the number of times the read was retried because it raced with
+  // the writer
+  size_t read(size_t index, SnapshotValue &out) const;
+
+  uint64_t generation() const;
+  size_t sensor_count() const { return header->sensor_count; }
+
+private:
+  ShmSnapshot(std::string name, void *mapping, size_t size, bool owner);
+
+  std::string name;
+  void *mapping;
+  size_t size;
+  bool owner;
+  SnapshotHeader *header;
+  SnapshotSlot *slots;
+};
+
+struct PollStats {
+  // Passes over the snapshot, and the ones that found it unchanged
+  size_t polls = 0;
+  size_t idle_polls = 0;
+  // New values seen, values published over before the poller got to them,
+  // and the reads that had to be retried
+  size_t values = 0;
+  size_t overwritten = 0;
+  size_t retries = 0;
+  // CPU time of the polling thread, and the time it was polling for
+  std::chrono::nanoseconds cpu{0};
+  std::chrono::steady_clock::duration wall{};
+  // From publish to the poller seeing the value
+  Histogram latency;
+
+  double cpu_percent() const;
+  void merge(const PollStats &other);
+};
+
+// Polls a snapshot from a thread of its own, the way a fan controller would
+// read its inputs, and measures how long every value took to become visible.
+// An interval of 0 spins.
+class ShmPoller {
+public:
+  ShmPoller(std::unique_ptr<ShmSnapshot> snapshot,
+            std::chrono::microseconds interval);
+  ~ShmPoller();
+
+  void start();
+  PollStats take_stats();
+  size_t sensor_count() const { return snapshot->sensor_count(); }
+
+private:
+  void run();
+  void poll(PollStats &interval);
+
+  std::unique_ptr<ShmSnapshot> snapshot;
+  std::chrono::microseconds interval;
+  std::vector<uint32_t> last_sequence;
+  uint64_t last_generation = 0;
+
+  std::atomic<bool> running{false};
+  std::thread thread;
+
+  std::mutex stats_mutex;
+  PollStats stats;
+  std::chrono::steady_clock::time_point stats_start;
+  std::chrono::nanoseconds last_cpu{0};
+};
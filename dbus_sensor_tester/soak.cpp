@@ -0,0 +1,191 @@
+#include "soak.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+
+static constexpr std::array<const char *, 3> series_names = {
+    "set_property", "signal", "delivery"};
+
+// Fewer buckets than this don't make a trend
+static constexpr size_t min_buckets = 3;
+
+double Trend::growth_percent() const {
+  return first > 0.0 ? 100.0 * (last - first) / first : 0.0;
+}
+
+static Trend fit(const std::vector<SoakBucket> &buckets,
+                 const std::function<double(const SoakBucket &)> &value) {
+  double n = static_cast<double>(buckets.size());
+  double sum_x = 0.0;
+  double sum_y = 0.0;
+  double sum_xx = 0.0;
+  double sum_xy = 0.0;
+  for (const SoakBucket &bucket : buckets) {
+    double hours = bucket.start / 3600.0;
+    double y = value(bucket);
+    sum_x += hours;
+    sum_y += y;
+    sum_xx += hours * hours;
+    sum_xy += hours * y;
+  }
+  Trend trend;
+  double denominator = n * sum_xx - sum_x * sum_x;
+  if (denominator != 0.0) {
+    trend.slope = (n * sum_xy - sum_x * sum_y) / denominator;
+  }
+  double intercept = (sum_y - trend.slope * sum_x) / n;
+  trend.first = intercept + trend.slope * buckets.front().start / 3600.0;
+  trend.last = intercept + trend.slope * buckets.back().start / 3600.0;
+  return trend;
+}
+
+SoakRecorder::SoakRecorder(std::chrono::seconds bucket_length,
+                           size_t capacity, std::chrono::seconds warmup)
+    : bucket_length(bucket_length), warmup(warmup), ring(capacity) {}
+
+void SoakRecorder::record_latency(SoakSeries series,
+                                  const Histogram &interval) {
+  latency[static_cast<size_t>(series)].merge(interval);
+}
+
+void SoakRecorder::end_interval(const IntervalSample &sample) {
+  double interval_start = previous_elapsed;
+  previous_elapsed = sample.elapsed;
+  // Nothing is kept of the warmup, allocators and caches are still filling
+  if (sample.elapsed <= static_cast<double>(warmup.count())) {
+    for (Histogram &histogram : latency) {
+      histogram.reset();
+    }
+    return;
+  }
+  if (!current) {
+    current.emplace();
+    current->start = interval_start;
+  }
+  current->updates += sample.updates;
+  current->signals += sample.signals;
+  current->tester_rss_bytes =
+      std::max(current->tester_rss_bytes, sample.tester_rss_bytes);
+  current->broker_rss_bytes =
+      std::max(current->broker_rss_bytes, sample.broker_rss_bytes);
+  if (sample.elapsed - current->start >=
+      static_cast<double>(bucket_length.count())) {
+    close_bucket();
+  }
+}
+
+void SoakRecorder::close_bucket() {
+  for (size_t series = 0; series < latency.size(); series++) {
+    current->p50[series] = latency[series].percentile(50.0);
+    current->p99[series] = latency[series].percentile(99.0);
+    latency[series].reset();
+  }
+  ring[head] = *current;
+  head = (head + 1) % ring.size();
+  count = std::min(count + 1, ring.size());
+  current.reset();
+}
+
+std::vector<SoakBucket> SoakRecorder::buckets() const {
+  std::vector<SoakBucket> ordered;
+  ordered.reserve(count);
+  for (size_t index = 0; index < count; index++) {
+    ordered.emplace_back(ring[(head + ring.size() - count + index) %
+                              ring.size()]);
+  }
+  return ordered;
+}
+
+bool SoakRecorder::evaluate(const SoakThresholds &thresholds) {
+  // A partial bucket at the end is too short to compare with the others
+  current.reset();
+  std::vector<SoakBucket> history = buckets();
+  verdict = {{"buckets", history.size()}};
+  if (history.size() < min_buckets) {
+    std::cout << "soak: only " << history.size()
+              << " buckets after the warmup, too few for a trend\n";
+    verdict["passed"] = true;
+    return true;
+  }
+
+  bool passed = true;
+  std::ios_base::fmtflags flags = std::cout.flags();
+  std::streamsize precision = std::cout.precision();
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "soak: trends over " << history.size() << " buckets, "
+            << (history.back().start - history.front().start) / 60.0
+            << " minutes\n";
+  auto check_rss = [&](const char *name, uint64_t SoakBucket::*rss) {
+    if (history.front().*rss == 0) {
+      return;
+    }
+    Trend trend = fit(history, [rss](const SoakBucket &bucket) {
+      return static_cast<double>(bucket.*rss) / 1024.0;
+    });
+    bool exceeded = trend.slope > thresholds.max_rss_growth_kib;
+    std::cout << name << " rss: " << trend.slope << " KiB per hour, "
+              << trend.first << " to " << trend.last << " KiB"
+              << (exceeded ? ", FAILED\n" : "\n");
+    verdict[name] = {{"rss_kib_per_hour", trend.slope},
+                     {"rss_first_kib", trend.first},
+                     {"rss_last_kib", trend.last}};
+    passed = passed && !exceeded;
+  };
+  check_rss("tester", &SoakBucket::tester_rss_bytes);
+  check_rss("broker", &SoakBucket::broker_rss_bytes);
+
+  for (size_t series = 0; series < series_names.size(); series++) {
+    bool recorded = std::ranges::any_of(
+        history,
+        [series](const SoakBucket &bucket) {
+          return bucket.p99[series].count() > 0;
+        });
+    if (!recorded) {
+      continue;
+    }
+    Trend trend = fit(history, [series](const SoakBucket &bucket) {
+      return std::chrono::duration<double, std::micro>(bucket.p99[series])
+          .count();
+    });
+    bool exceeded =
+        trend.growth_percent() > thresholds.max_p99_growth_percent;
+    std::cout << series_names[series] << " p99: " << trend.first << "us to "
+              << trend.last << "us, " << trend.growth_percent() << "%"
+              << (exceeded ? ", FAILED\n" : "\n");
+    verdict[series_names[series]] = {
+        {"p99_first_us", trend.first},
+        {"p99_last_us", trend.last},
+        {"p99_growth_percent", trend.growth_percent()}};
+    passed = passed && !exceeded;
+  }
+  std::cout.flags(flags);
+  std::cout.precision(precision);
+  verdict["passed"] = passed;
+  return passed;
+}
+
+nlohmann::json SoakRecorder::to_json() const {
+  nlohmann::json::array_t history;
+  for (const SoakBucket &bucket : buckets()) {
+    nlohmann::json entry = {
+        {"start_s", bucket.start},
+        {"updates", bucket.updates},
+        {"signals", bucket.signals},
+        {"tester_rss_bytes", bucket.tester_rss_bytes},
+        {"broker_rss_bytes", bucket.broker_rss_bytes},
+    };
+    for (size_t series = 0; series < series_names.size(); series++) {
+      std::string name = series_names[series];
+      entry[name + "_p50_ns"] = bucket.p50[series].count();
+      entry[name + "_p99_ns"] = bucket.p99[series].count();
+    }
+    history.emplace_back(std::move(entry));
+  }
+  nlohmann::json output = verdict;
+  output["history"] = history;
+  return output;
+}
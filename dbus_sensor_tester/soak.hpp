@@ -0,0 +1,87 @@
+#pragma once
+
+#include "histogram.hpp"
+#include "results.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Latencies a soak run follows over time
+enum class SoakSeries {
+  set_property,
+  signal,
+  delivery,
+};
+
+// One bucket, normally a minute, of a soak run
+struct SoakBucket {
+  // Seconds since the reporter started
+  double start = 0.0;
+  uint64_t updates = 0;
+  uint64_t signals = 0;
+  std::array<std::chrono::nanoseconds, 3> p50{};
+  std::array<std::chrono::nanoseconds, 3> p99{};
+  // Highest RSS seen during the bucket
+  uint64_t tester_rss_bytes = 0;
+  uint64_t broker_rss_bytes = 0;
+};
+
+// Least squares line through one value of every bucket
+struct Trend {
+  // Per hour, in the unit of the value
+  double slope = 0.0;
+  // Fitted values at the first and the last bucket
+  double first = 0.0;
+  double last = 0.0;
+
+  double growth_percent() const;
+};
+
+struct SoakThresholds {
+  // RSS growth of the tester or the broker, in KiB per hour
+  double max_rss_growth_kib = 1024.0;
+  // Growth of any p99 over the run, in percent of its fitted start
+  double max_p99_growth_percent = 20.0;
+};
+
+// Aggregates the report intervals of a long run into buckets, keeping the
+// latest capacity of them in a ring buffer, so a run of days holds a
+// constant amount of history.  At the end a trend is fitted through every
+// series and the run fails if memory or a p99 grew beyond the thresholds,
+// which is how slow leaks in the broker or the tester show up.
+class SoakRecorder {
+public:
+  SoakRecorder(std::chrono::seconds bucket_length, size_t capacity,
+               std::chrono::seconds warmup);
+
+  // The interval histograms, before they are reset for the next interval
+  void record_latency(SoakSeries series, const Histogram &latency);
+  // Closes the interval, and the bucket once it is full
+  void end_interval(const IntervalSample &sample);
+
+  // Prints the trends, returns false if a threshold was exceeded
+  bool evaluate(const SoakThresholds &thresholds);
+  nlohmann::json to_json() const;
+
+private:
+  void close_bucket();
+  std::vector<SoakBucket> buckets() const;
+
+  std::chrono::seconds bucket_length;
+  std::chrono::seconds warmup;
+
+  std::vector<SoakBucket> ring;
+  size_t head = 0;
+  size_t count = 0;
+
+  double previous_elapsed = 0.0;
+  std::optional<SoakBucket> current;
+  std::array<Histogram, 3> latency;
+
+  nlohmann::json verdict;
+};
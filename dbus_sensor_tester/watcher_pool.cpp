@@ -0,0 +1,115 @@
+#include "watcher_pool.hpp"
+
+#include "decode.hpp"
+#include "probe.hpp"
+#include "read_client.hpp"
+#include "sensor_shard.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <utility>
+
+void WatchStats::merge(const WatchStats &other) {
+  deliveries += other.deliveries;
+  latency.merge(other.latency);
+}
+
+WatcherPool::WatcherPool(size_t watchers, size_t matches, MatchStyle style,
+                         bool end_to_end)
+    : style(style), matches_per_watcher(matches), end_to_end(end_to_end) {
+  for (size_t index = 0; index < watchers; index++) {
+    connections.emplace_back(open_connection(io));
+  }
+}
+
+WatcherPool::~WatcherPool() {
+  io.stop();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+std::string WatcherPool::rule_for(const std::string &path) const {
+  std::string rule = "type='signal',interface='org.freedesktop.DBus."
+                     "Properties',member='PropertiesChanged',path='" +
+                     path + "'";
+  if (style == MatchStyle::interface) {
+    rule += ",arg0='xyz.openbmc_project.Sensor.Value'";
+  } else if (style == MatchStyle::arg0_namespace) {
+    rule += ",arg0namespace='xyz.openbmc_project.Sensor'";
+  }
+  return rule;
+}
+
+// In the same process as the producer, its connection only answers once
+// the main loop runs, so the objects are listed asynchronously from the
+// watcher thread
+void WatcherPool::start(const std::string &service) {
+  if (style == MatchStyle::path_namespace) {
+    install({});
+  } else {
+    sdbusplus::message_t discover = connections.front()->new_method_call(
+        service.c_str(), "/", "org.freedesktop.DBus.ObjectManager",
+        "GetManagedObjects");
+    connections.front()->async_send(
+        discover, [this, service](const boost::system::error_code &error,
+                                  sdbusplus::message_t reply) {
+          if (error) {
+            std::cerr << "Can't list objects of " << service << ": "
+                      << error.message() << "\n";
+            return;
+          }
+          std::optional<std::vector<std::string>> paths =
+              managed_object_paths(reply);
+          if (!paths || paths->empty()) {
+            std::cerr << service << " has no objects to watch\n";
+            return;
+          }
+          install(*paths);
+        });
+  }
+  thread = std::thread([this]() { io.run(); });
+}
+
+void WatcherPool::install(const std::vector<std::string> &paths) {
+  size_t per_watcher = paths.empty()
+                           ? 1
+                           : std::min(matches_per_watcher, paths.size());
+  size_t next_path = 0;
+  for (auto &connection : connections) {
+    for (size_t index = 0; index < per_watcher; index++) {
+      std::string rule;
+      if (paths.empty()) {
+        rule = "type='signal',member='PropertiesChanged',path_namespace='/"
+               "xyz/openbmc_project/sensors'";
+      } else {
+        rule = rule_for(paths[next_path]);
+        next_path = (next_path + 1) % paths.size();
+      }
+      matches.emplace_back(
+          static_cast<sdbusplus::bus_t &>(*connection), rule,
+          std::bind_front(&WatcherPool::on_signal, this));
+    }
+  }
+  std::cout << "Watching with " << connections.size() << " connections, "
+            << matches.size() << " match rules\n";
+}
+
+void WatcherPool::on_signal(sdbusplus::message_t &message) {
+  std::optional<std::chrono::microseconds> age;
+  double value = 0.0;
+  if (end_to_end && decode_sensor_value(message.get(), &value) > 0) {
+    age = Probe::decode(value).age();
+  }
+  std::lock_guard lock(stats_mutex);
+  stats.deliveries++;
+  if (age) {
+    stats.latency.record(*age);
+  }
+}
+
+WatchStats WatcherPool::take_stats() {
+  std::lock_guard lock(stats_mutex);
+  return std::exchange(stats, WatchStats());
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <mutex>
+#include <sdbusplus/asio/connection.hpp>
+#include <sdbusplus/bus/match.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The match rules each watcher installs for its share of the sensors
+enum class MatchStyle {
+  // One path_namespace rule covering every sensor, as -w does
+  path_namespace,
+  // PropertiesChanged on one object path
+  path,
+  // PropertiesChanged of the Sensor.Value interface on one object path, what
+  // sdbusplus::bus::match::rules::propertiesChanged builds
+  interface,
+  // PropertiesChanged on one object path with an arg0namespace on the
+  // Sensor interfaces
+  arg0_namespace,
+};
+
+struct WatchStats {
+  // Signals dispatched to a match callback, summed over all watchers
+  size_t deliveries = 0;
+  // Probe age on arrival, in end to end mode
+  Histogram latency;
+
+  void merge(const WatchStats &other);
+};
+
+// A number of watcher connections, like the services of a BMC that each
+// follow the sensors they care about, with match rules for a number of
+// sensor paths each.  Every rule is on a different path, spread round robin
+// over the objects of the service, so the broker has watchers * matches
+// rules to evaluate for every signal.  The watchers run on a thread of
+// their own.
+class WatcherPool {
+public:
+  WatcherPool(size_t watchers, size_t matches, MatchStyle style,
+              bool end_to_end);
+  ~WatcherPool();
+
+  // Lists the objects of service, then installs the match rules
+  void start(const std::string &service);
+  WatchStats take_stats();
+
+  size_t watcher_count() const { return connections.size(); }
+
+private:
+  std::string rule_for(const std::string &path) const;
+  // No paths installs the path_namespace rule
+  void install(const std::vector<std::string> &paths);
+  void on_signal(sdbusplus::message_t &message);
+
+  MatchStyle style;
+  size_t matches_per_watcher;
+  bool end_to_end;
+
+  boost::asio::io_context io;
+  std::vector<std::shared_ptr<sdbusplus::asio::connection>> connections;
+  std::vector<sdbusplus::bus::match_t> matches;
+  std::thread thread;
+
+  std::mutex stats_mutex;
+  WatchStats stats;
+};
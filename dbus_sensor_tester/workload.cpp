@@ -0,0 +1,95 @@
+#include "workload.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+// Sensor types and the Sensor.Value unit each of them reports in
+static constexpr std::array<std::pair<const char *, const char *>, 5>
+    sensor_units = {{
+        {"temperature", "xyz.openbmc_project.Sensor.Value.Unit.DegreesC"},
+        {"voltage", "xyz.openbmc_project.Sensor.Value.Unit.Volts"},
+        {"fan_tach", "xyz.openbmc_project.Sensor.Value.Unit.RPMS"},
+        {"power", "xyz.openbmc_project.Sensor.Value.Unit.Watts"},
+        {"current", "xyz.openbmc_project.Sensor.Value.Unit.Amperes"},
+    }};
+
+static std::chrono::steady_clock::duration from_millis(double millis) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(millis));
+}
+
+size_t Workload::sensor_count() const {
+  size_t count = 0;
+  for (const SensorClass &sensor_class : classes) {
+    count += sensor_class.count;
+  }
+  return count;
+}
+
+const SensorClass &Workload::class_of(size_t sensor_index) const {
+  for (const SensorClass &sensor_class : classes) {
+    if (sensor_index < sensor_class.count) {
+      return sensor_class;
+    }
+    sensor_index -= sensor_class.count;
+  }
+  return classes.back();
+}
+
+std::optional<Workload> load_workload(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "Can't open workload profile " << filename << "\n";
+    return std::nullopt;
+  }
+
+  Workload workload;
+  try {
+    nlohmann::json profile = nlohmann::json::parse(file);
+    workload.seed = profile.value("seed", uint32_t{0});
+    for (const nlohmann::json &entry : profile.at("sensors")) {
+      SensorClass sensor_class;
+      sensor_class.type = entry.at("type").get<std::string>();
+      for (const auto &[type, unit] : sensor_units) {
+        if (sensor_class.type == type) {
+          sensor_class.unit = unit;
+        }
+      }
+      if (sensor_class.unit.empty()) {
+        std::cerr << "Unknown sensor type " << sensor_class.type << " in "
+                  << filename << "\n";
+        return std::nullopt;
+      }
+      sensor_class.name = entry.value("name", sensor_class.type);
+      sensor_class.count = entry.at("count").get<size_t>();
+      double period_ms = entry.value("period_ms", 1000.0);
+      double jitter_ms = entry.value("jitter_ms", 0.0);
+      sensor_class.change_probability =
+          entry.value("change_probability", 1.0);
+      if (period_ms <= 0.0 || jitter_ms < 0.0 || jitter_ms >= period_ms ||
+          sensor_class.change_probability < 0.0 ||
+          sensor_class.change_probability > 1.0) {
+        std::cerr << "Invalid timing or probability for "
+                  << sensor_class.type << " in " << filename << "\n";
+        return std::nullopt;
+      }
+      sensor_class.period = from_millis(period_ms);
+      sensor_class.jitter = from_millis(jitter_ms);
+      workload.classes.emplace_back(std::move(sensor_class));
+    }
+  } catch (const nlohmann::json::exception &e) {
+    std::cerr << "Can't parse workload profile " << filename << ": "
+              << e.what() << "\n";
+    return std::nullopt;
+  }
+
+  if (workload.sensor_count() == 0) {
+    std::cerr << "Workload profile " << filename << " has no sensors\n";
+    return std::nullopt;
+  }
+  return workload;
+}
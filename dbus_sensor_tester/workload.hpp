@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// One group of identical sensors in a workload profile
+struct SensorClass {
+  // Sensor type, which is also the namespace under /xyz/openbmc_project/sensors
+  std::string type;
+  std::string unit;
+  // Object names are name followed by the global sensor index
+  std::string name;
+  size_t count = 0;
+  // Every sensor is polled once a period, at a random phase, with each poll
+  // moved by up to +-jitter
+  std::chrono::steady_clock::duration period = std::chrono::seconds(1);
+  std::chrono::steady_clock::duration jitter{};
+  // Chance that a poll finds a new value, unchanged values are not published
+  double change_probability = 1.0;
+};
+
+// A JSON workload profile, for example:
+//   {
+//     "seed": 1,
+//     "sensors": [
+//       {"type": "voltage", "count": 40, "period_ms": 1000, "jitter_ms": 50,
+//        "change_probability": 0.1},
+//       {"type": "fan_tach", "count": 12, "period_ms": 250,
+//        "change_probability": 0.9}
+//     ]
+//   }
+// Known types are temperature, voltage, fan_tach, power and current.
+struct Workload {
+  uint32_t seed = 0;
+  std::vector<SensorClass> classes;
+
+  size_t sensor_count() const;
+  // The class of the sensor with the given global index
+  const SensorClass &class_of(size_t sensor_index) const;
+};
+
+// Prints the problem and returns nothing if the profile can't be used
+std::optional<Workload> load_workload(const std::string &filename);
@@ -541,6 +541,21 @@ ssize_t sigwrap_readv(int fd, const struct iovec *iov, int iovcnt)
 }
 
 
+ssize_t sigwrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	while (1)
+	{
+		ssize_t Result = pread(fd, buf, count, offset);
+
+		if (Result != -1)
+			return (Result);
+
+		if (errno != EINTR)
+			return (Result);
+	}
+}
+
+
 ssize_t sigwrap_recv(int sockfd, void *buf, size_t len, int flags)
 {
 	while (1)
@@ -650,6 +665,21 @@ ssize_t sigwrap_writev(int fd, const struct iovec *iov, int iovcnt)
 }
 
 
+ssize_t sigwrap_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	while (1)
+	{
+		ssize_t Result = pwrite(fd, buf, count, offset);
+
+		if (Result != -1)
+			return (Result);
+
+		if (errno != EINTR)
+			return (Result);
+	}
+}
+
+
 int sigwrap_close(int hFile)
 {
 	while (close(hFile) == -1)
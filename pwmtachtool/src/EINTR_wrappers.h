@@ -97,6 +97,8 @@ ssize_t sigwrap_blocking_read(int hFile, void *pData, size_t RdLen);
 
 ssize_t sigwrap_readv(int fd, const struct iovec *iov, int iovcnt);
 
+ssize_t sigwrap_pread(int fd, void *buf, size_t count, off_t offset);
+
 ssize_t sigwrap_write(int fd, const void *buf, size_t count);
 // EINTR wrapper for the standard write() function. Waits until ALL data is written! Use the non-blocking version (sigwrap_write)
 // for sockets that are set to non-blocking mode, or when it is OK to write only partial data.
@@ -111,6 +113,8 @@ ssize_t sigwrap_blocking_write(int hFile, const void *pData, ssize_t WrtLen);
 
 ssize_t sigwrap_writev(int fd, const struct iovec *iov, int iovcnt);
 
+ssize_t sigwrap_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
 ssize_t sigwrap_recv(int sockfd, void *buf, size_t len, int flags);
 
 ssize_t sigwrap_recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
@@ -11,11 +11,15 @@
 #ifndef LIBPWMTACH_H
 #define LIBPWMTACH_H
 
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define PWMTACH_DEV_FILE   "/dev/pwmtach"
+#define PWMTACH_MAX_TACHS  32
+#define PWMTACH_MAX_PWMS   32
 
 	/** \file libpwmtach.h
 	 *  \brief Public headers for the PWMTACH interface library
@@ -25,6 +29,9 @@ extern "C" {
 	 */
 	extern int set_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int rpm_value );
 	extern int get_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int *rpm_value );
+	//Reads fan1_input up to the last consecutive fanN_input of the device into rpm_values[0] onwards,
+	//at most max_tachs of them, and stores how many were read in tach_count.
+	extern int get_all_tach_speeds ( unsigned int dev_id, unsigned int *rpm_values, unsigned int max_tachs, unsigned int *tach_count );
 	/************/
 
 
@@ -38,6 +45,96 @@ extern "C" {
 	extern int get_pwm_dutycycle ( unsigned int dev_id, unsigned char pwm_number, unsigned char *dutycycle_percentage );
 
 	/************/
+
+
+	/******Opened node interface for control loops sampling the same channels over and over********/
+	/*********The node is resolved and opened once, every sample after that is a single pread/pwrite***********/
+#define PWMTACH_NODE_TACH	0
+#define PWMTACH_NODE_PWM	1
+
+	typedef struct
+	{
+		int fd;
+		unsigned int dev_id;
+		unsigned int number;
+		unsigned char type;
+	} pwmtach_node_t;
+
+	extern int open_tach_node ( unsigned int dev_id, unsigned char tach_number, pwmtach_node_t *node );
+	extern int open_pwm_node ( unsigned int dev_id, unsigned char pwm_number, pwmtach_node_t *node );
+	extern int read_tach_node ( pwmtach_node_t *node, unsigned int *rpm_value );
+	//Notice: dutycycle_value is one byte (0-255)
+	extern int read_pwm_node ( pwmtach_node_t *node, unsigned char *dutycycle_value );
+	extern int write_pwm_node ( pwmtach_node_t *node, unsigned char dutycycle_value );
+	extern void close_pwmtach_node ( pwmtach_node_t *node );
+	//The per channel functions above keep their nodes open between calls, this closes all of them.
+	extern void close_pwmtach_nodes ( void );
+
+	/************/
+
+
+	/******Context interface: all state of one hwmon device lives in a caller owned context********/
+	/*********Separate contexts can be used from separate threads, a context from one thread at a time.
+	 *        The per device functions above are wrappers locking a context shared per device.***********/
+	typedef struct pwmtach_context pwmtach_context_t;
+
+	extern pwmtach_context_t *pwmtach_open_context ( unsigned int dev_id );
+	extern void pwmtach_close_context ( pwmtach_context_t *ctx );
+	extern int pwmtach_set_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int rpm_value );
+	extern int pwmtach_get_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int *rpm_value );
+	extern int pwmtach_get_all_tach_speeds ( pwmtach_context_t *ctx, unsigned int *rpm_values, unsigned int max_tachs, unsigned int *tach_count );
+	extern int pwmtach_get_tach_speed ( pwmtach_context_t *ctx, unsigned char tach_number, unsigned int *rpm_value );
+	//Notice: dutycycle_percentage value should be between 1 to 99.
+	extern int pwmtach_set_pwm_dutycycle ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char dutycycle_percentage );
+	//Notice: dutycycle_value should be between 0 to 255.
+	extern int pwmtach_set_pwm_dutycycle_value ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char dutycycle_value );
+	extern int pwmtach_get_pwm_dutycycle ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char *dutycycle_percentage );
+
+	/*********Closed loop fan speed control, used by set_fan_speed with the default tuning***********/
+	typedef struct
+	{
+		float kp;			//dutycycle counts (0-255) per RPM of error
+		float ki;			//counts per RPM of error per second
+		float kd;			//counts per RPM per second of change
+		unsigned int sample_ms;		//tach sampling and pwm update period
+		float tolerance_percent;	//of the target RPM
+		unsigned int settle_samples;	//consecutive samples within tolerance to call it settled
+		unsigned int timeout_ms;
+	} pwmtach_pid_config_t;
+
+	typedef struct
+	{
+		unsigned char settled;
+		unsigned int settle_ms;		//from the first pwm write to the first of the samples within tolerance
+		unsigned int overshoot_rpm;	//furthest past the target, on the far side from the starting speed
+		unsigned int final_rpm;
+		unsigned char final_dutycycle;	//0 to 255
+	} pwmtach_pid_result_t;
+
+	extern void pwmtach_default_pid_config ( pwmtach_pid_config_t *config );
+	extern int pwmtach_control_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int rpm_value,
+			const pwmtach_pid_config_t *config, pwmtach_pid_result_t *result );
+
+	/*********Continuous sampling of every tach and pwm of the device, all nodes kept open***********/
+	typedef struct
+	{
+		struct timespec timestamp;		//CLOCK_REALTIME when the sample was read
+		unsigned char notified;			//woken by the driver's sysfs_notify rather than the timer
+		unsigned int missed;			//timer periods that passed without a sample
+		unsigned int tach_count;
+		unsigned int rpm_values[PWMTACH_MAX_TACHS];
+		unsigned int pwm_count;
+		unsigned char dutycycle_values[PWMTACH_MAX_PWMS];	//0 to 255
+	} pwmtach_sample_t;
+
+	//return non zero to stop monitoring
+	typedef int (*pwmtach_sample_handler) ( const pwmtach_sample_t *sample, void *user_data );
+
+	//Samples every interval_ms, and whenever the driver notifies a node, until samples have been taken
+	//(0 for no limit) or the handler asks to stop.
+	extern int pwmtach_monitor ( pwmtach_context_t *ctx, unsigned int interval_ms, unsigned int samples, pwmtach_sample_handler handler, void *user_data );
+
+	/************/
 #ifdef __cplusplus
 }
 #endif
@@ -14,23 +14,18 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <string.h>
+#include <dirent.h>
 #include "libpwmtach.h"
 #include "pwmtach_ioctl.h"
 #include "EINTR_wrappers.h"
 #include <stdlib.h>
-
-void select_sleep(time_t sec,suseconds_t usec)
-{
-	struct timeval tv;
-
-	tv.tv_sec = sec;
-	tv.tv_usec = usec;
-
-	while(sigwrap_select(0, NULL, NULL, NULL, &tv) < 0);
-}
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 //support acessing driver using sysfs device file 
-static char DevNodeFileName[50];
 #define HWMON_DIR "/sys/class/hwmon"
 
 //build the pwm and tach access device node file name, and mapping pwm/tach number starting from 1.
@@ -41,6 +36,8 @@ static char DevNodeFileName[50];
 //predefine FAN RPM range, must defined at some where for configuration.
 #define RPM_MAX         38600
 #define RPM_MIN         7500
+//the full RPM range over the 255 dutycycle counts, about 150 RPM moved by one count
+#define RPM_PER_COUNT   (RPM_MAX / 255)
 #define COUNTERRES_DEF  100
 
 /* Check hwmon if exist or not */
@@ -55,46 +52,221 @@ static int pwmtach_directory_check(void)
 	}
 	return retval;
 }
-//Notice: dutycycle_value is one byte (0-255)
-static int SET_PWM_DUTYCYCLE_VALUE ( pwmtach_ioctl_data  *ppwmtach_arg )
+/* Resolve and open a pwm or tach node, the only place the path is walked */
+static int open_node(unsigned int dev_id, unsigned int number, unsigned char type, pwmtach_node_t *node)
 {
+	char path[64];
 	int retval = 0;
-	unsigned char dutycycle_value;
-	int fd;
-	char duty_num[5];
 
+	node->fd = -1;
 	retval = pwmtach_directory_check();
 	if(retval != 0)
 	{
 		return retval;
 	}
 
-	dutycycle_value = ppwmtach_arg->dutycycle;
-	BUILD_PWM_NODE_NAME(DevNodeFileName,ppwmtach_arg->dev_id,ppwmtach_arg->pwmnumber);
-	retval = access(DevNodeFileName,F_OK);
-	if(retval != 0)
+	if (type == PWMTACH_NODE_PWM)
 	{
-		return retval;
+		BUILD_PWM_NODE_NAME(path,dev_id,number);
+		node->fd = sigwrap_open(path, O_RDWR);
 	}
+	else
+	{
+		BUILD_TACH_NODE_NAME(path,dev_id,number);
+		node->fd = sigwrap_open(path, O_RDONLY);
+	}
+	if (node->fd < 0)
+	{
+		printf("%s,%s not exist\n",__FUNCTION__,path);
+		return -1;
+	}
+	node->dev_id = dev_id;
+	node->number = number;
+	node->type = type;
+	return 0;
+}
 
-	fd = sigwrap_open(DevNodeFileName, O_WRONLY);
-	if (fd < 0) {
-		return fd;
+/* sysfs regenerates an attribute on every read at offset 0, so the same fd gives a fresh sample each time */
+static int read_node_value(pwmtach_node_t *node, int *value)
+{
+	char data[16];
+	ssize_t len;
+
+	len = sigwrap_pread(node->fd, data, sizeof(data) - 1, 0);
+	if (len <= 0)
+	{
+		printf("%s: Error reading node %d of hwmon%d\n",__FUNCTION__,node->number,node->dev_id);
+		return -1;
+	}
+	data[len] = '\0';
+	*value = atoi(data);
+	return 0;
+}
+
+int open_tach_node ( unsigned int dev_id, unsigned char tach_number, pwmtach_node_t *node )
+{
+	return open_node(dev_id, tach_number, PWMTACH_NODE_TACH, node);
+}
+
+int open_pwm_node ( unsigned int dev_id, unsigned char pwm_number, pwmtach_node_t *node )
+{
+	return open_node(dev_id, pwm_number, PWMTACH_NODE_PWM, node);
+}
+
+int read_tach_node ( pwmtach_node_t *node, unsigned int *rpm_value )
+{
+	int value = 0;
+
+	if (read_node_value(node, &value) != 0)
+	{
+		return -1;
 	}
+	*rpm_value = value;
+	return 0;
+}
+
+//Notice: dutycycle_value is one byte (0-255)
+int read_pwm_node ( pwmtach_node_t *node, unsigned char *dutycycle_value )
+{
+	int value = 0;
+
+	if (read_node_value(node, &value) != 0)
+	{
+		return -1;
+	}
+	*dutycycle_value = value;
+	return 0;
+}
+
+int write_pwm_node ( pwmtach_node_t *node, unsigned char dutycycle_value )
+{
+	char duty_num[5];
 
 	snprintf(duty_num,5, "%d", dutycycle_value);
+	if (sigwrap_pwrite(node->fd, duty_num, strlen(duty_num), 0) != (ssize_t)strlen(duty_num))
+	{
+		printf("%s: Error write dutycycle value %d to pwm %d\n",__FUNCTION__,dutycycle_value,node->number);
+		return -1;
+	}
+	return 0;
+}
 
-	if ( write(fd, duty_num, strlen (duty_num)) != (ssize_t )strlen(duty_num)){
-		printf("%s: Error write dutycycle value %d to pwm %d\n",__FUNCTION__,dutycycle_value,ppwmtach_arg->pwmnumber);
-		retval = -1;
+void close_pwmtach_node ( pwmtach_node_t *node )
+{
+	if (node->fd >= 0)
+	{
+		(void)sigwrap_close(node->fd);
+		node->fd = -1;
 	}
-	(void)sigwrap_close(fd);
+}
 
-	return retval;
+//all per device state lives here, so separate contexts can be used from separate threads
+struct pwmtach_context
+{
+	unsigned int dev_id;
+	pwmtach_node_t tachs[PWMTACH_MAX_TACHS];
+	pwmtach_node_t pwms[PWMTACH_MAX_PWMS];
+	//held while a per device function uses one of the default contexts
+	pthread_mutex_t lock;
+	struct pwmtach_context *next;
+};
+
+pwmtach_context_t *pwmtach_open_context ( unsigned int dev_id )
+{
+	pwmtach_context_t *ctx;
+	int i;
+
+	ctx = calloc(1, sizeof(pwmtach_context_t));
+	if (ctx == NULL)
+	{
+		printf("%s: out of memory\n",__FUNCTION__);
+		return NULL;
+	}
+	ctx->dev_id = dev_id;
+	for (i = 0; i < PWMTACH_MAX_TACHS; i++)
+	{
+		ctx->tachs[i].fd = -1;
+	}
+	for (i = 0; i < PWMTACH_MAX_PWMS; i++)
+	{
+		ctx->pwms[i].fd = -1;
+	}
+	pthread_mutex_init(&ctx->lock, NULL);
+	return ctx;
+}
+
+static void close_context_nodes(pwmtach_context_t *ctx)
+{
+	int i;
+
+	for (i = 0; i < PWMTACH_MAX_TACHS; i++)
+	{
+		close_pwmtach_node(&ctx->tachs[i]);
+	}
+	for (i = 0; i < PWMTACH_MAX_PWMS; i++)
+	{
+		close_pwmtach_node(&ctx->pwms[i]);
+	}
+}
+
+void pwmtach_close_context ( pwmtach_context_t *ctx )
+{
+	if (ctx == NULL)
+	{
+		return;
+	}
+	close_context_nodes(ctx);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+//a node is opened on first use and then kept open for the life of the context
+static pwmtach_node_t *get_cached_node(pwmtach_context_t *ctx, unsigned int number, unsigned char type)
+{
+	pwmtach_node_t *node;
+
+	if (number >= ((type == PWMTACH_NODE_PWM) ? PWMTACH_MAX_PWMS : PWMTACH_MAX_TACHS))
+	{
+		printf("%s: channel %d out of range\n",__FUNCTION__,number);
+		return NULL;
+	}
+	node = (type == PWMTACH_NODE_PWM) ? &ctx->pwms[number] : &ctx->tachs[number];
+	if (node->fd < 0)
+	{
+		if (open_node(ctx->dev_id, number, type, node) != 0)
+		{
+			return NULL;
+		}
+	}
+	return node;
+}
+
+//a node failing to read or write is closed, the next call resolves it again in case the hwmon device was rebound
+static void drop_cached_node(pwmtach_node_t *node)
+{
+	close_pwmtach_node(node);
+}
+
+//Notice: dutycycle_value is one byte (0-255)
+static int SET_PWM_DUTYCYCLE_VALUE ( pwmtach_context_t *ctx, pwmtach_ioctl_data  *ppwmtach_arg )
+{
+	pwmtach_node_t *node;
+
+	node = get_cached_node(ctx, ppwmtach_arg->pwmnumber, PWMTACH_NODE_PWM);
+	if (node == NULL)
+	{
+		return -1;
+	}
+	if (write_pwm_node(node, ppwmtach_arg->dutycycle) != 0)
+	{
+		drop_cached_node(node);
+		return -1;
+	}
+	return 0;
 }
 
 //Notice: dutycycle_percentage value should be between 1 to 99.
-static int SET_PWM_DUTYCYCLE ( pwmtach_ioctl_data  *ppwmtach_arg)
+static int SET_PWM_DUTYCYCLE ( pwmtach_context_t *ctx, pwmtach_ioctl_data  *ppwmtach_arg)
 {
 	int retval = 0;
 	unsigned char dutycycle_value;
@@ -106,67 +278,46 @@ static int SET_PWM_DUTYCYCLE ( pwmtach_ioctl_data  *ppwmtach_arg)
 
 	dutycycle_value = (ppwmtach_arg->dutycycle*255)/100;
 	ppwmtach_arg->dutycycle = dutycycle_value;
-	retval = SET_PWM_DUTYCYCLE_VALUE(ppwmtach_arg);
+	retval = SET_PWM_DUTYCYCLE_VALUE(ctx, ppwmtach_arg);
 	return retval;
 }
 
-static int GET_PWM_DUTYCYCLE ( pwmtach_ioctl_data  *ppwmtach_arg )
+static int GET_PWM_DUTYCYCLE ( pwmtach_context_t *ctx, pwmtach_ioctl_data  *ppwmtach_arg )
 {
-	int retval = 0;
-	int fd;
-	char duty_num[5];
-
-	retval = pwmtach_directory_check();
-	if(retval != 0)
-	{//printf("%s,error 0\n",__FUNCTION__); 
-		return retval;
-	}
+	pwmtach_node_t *node;
 
-	BUILD_PWM_NODE_NAME(DevNodeFileName,ppwmtach_arg->dev_id,ppwmtach_arg->pwmnumber);
-	retval = access(DevNodeFileName,F_OK);
-	if(retval != 0)
-	{printf("%s,error 2,%s not exist\n",__FUNCTION__,DevNodeFileName); 
-		return retval;
+	node = get_cached_node(ctx, ppwmtach_arg->pwmnumber, PWMTACH_NODE_PWM);
+	if (node == NULL)
+	{printf("%s,error 3\n",__FUNCTION__); 
+		return -1;
 	}
-	fd = sigwrap_open(DevNodeFileName, O_RDONLY);
-	if (fd < 0) {printf("%s,error 3\n",__FUNCTION__); 
-		return fd;
+	if (read_pwm_node(node, &ppwmtach_arg->dutycycle) != 0)
+	{
+		drop_cached_node(node);
+		return -1;
 	}
-	read(fd, duty_num, 5);
-	ppwmtach_arg->dutycycle = atoi(duty_num);
 	printf("%s:dutycycle value %d to pwm %d\n",__FUNCTION__,ppwmtach_arg->dutycycle,ppwmtach_arg->pwmnumber);
-	(void)sigwrap_close(fd);
 
-	return retval;
+	return 0;
 }
-int GET_TACH_SPEED (pwmtach_ioctl_data *ppwmtach_arg )
+static int GET_TACH_SPEED ( pwmtach_context_t *ctx, pwmtach_ioctl_data *ppwmtach_arg )
 {
-	int retval = 0;
-	int fd;
-	char data[6];
+	pwmtach_node_t *node;
+	unsigned int rpm_value = 0;
 
-	retval = pwmtach_directory_check();
-	if(retval != 0)
-	{printf("%s,error 0\n",__FUNCTION__); 
-		return retval;
-	}
-	BUILD_TACH_NODE_NAME(DevNodeFileName,ppwmtach_arg->dev_id,ppwmtach_arg->tachnumber);
-	retval = access(DevNodeFileName,F_OK);
-	if(retval != 0)
-	{printf("%s,error 2,%s not exist\n",__FUNCTION__,DevNodeFileName); 
-		return retval;
+	node = get_cached_node(ctx, ppwmtach_arg->tachnumber, PWMTACH_NODE_TACH);
+	if (node == NULL)
+	{printf("%s,error 3\n",__FUNCTION__); 
+		return -1;
 	}
-
-	fd = sigwrap_open(DevNodeFileName, O_RDONLY);
-	if (fd < 0) {printf("%s,error 3\n",__FUNCTION__); 
-		return fd;
+	if (read_tach_node(node, &rpm_value) != 0)
+	{
+		drop_cached_node(node);
+		return -1;
 	}
-	memset(data, 0, 6);
-	read(fd, data, 6);
-	ppwmtach_arg->rpmvalue = atoi(data);
-	(void)sigwrap_close(fd);
+	ppwmtach_arg->rpmvalue = rpm_value;
 	printf("%s:rpm value %d\n",__FUNCTION__,ppwmtach_arg->rpmvalue);
-	return retval;
+	return 0;
 }
 //mapping function of fan to tach
 //using direct mapping as default
@@ -175,6 +326,7 @@ int GET_TACH_SPEED (pwmtach_ioctl_data *ppwmtach_arg )
 //using information in fan@number reg item, to look up the pwm index
 static int GET_PWM_NUMBER(pwmtach_ioctl_data *ppwmtach_arg)
 {
+	char path[64];
 	int retval = 0;
 	int fd;
 	int reg_val = 0;
@@ -184,14 +336,14 @@ static int GET_PWM_NUMBER(pwmtach_ioctl_data *ppwmtach_arg)
 	{printf("%s,error 0\n",__FUNCTION__); 
 		return retval;
 	}
-	BUILD_FAN_REG_NAME(DevNodeFileName,ppwmtach_arg->dev_id,ppwmtach_arg->fannumber);
-	retval = access(DevNodeFileName,F_OK);
+	BUILD_FAN_REG_NAME(path,ppwmtach_arg->dev_id,ppwmtach_arg->fannumber);
+	retval = access(path,F_OK);
 	if(retval != 0)
-	{printf("%s,error 2,%s not exist\n",__FUNCTION__,DevNodeFileName); 
+	{printf("%s,error 2,%s not exist\n",__FUNCTION__,path); 
 		return retval;
 	}
 
-	fd = sigwrap_open(DevNodeFileName, O_RDONLY);
+	fd = sigwrap_open(path, O_RDONLY);
 	if (fd < 0) {printf("%s,error 3\n",__FUNCTION__); 
 		return fd;
 	}
@@ -203,34 +355,34 @@ static int GET_PWM_NUMBER(pwmtach_ioctl_data *ppwmtach_arg)
 	{
 		retval = reg_val >> 24; //get the highest byte
 		printf("%s:fan %d, pwm %d, val 0x%X\n",__FUNCTION__,ppwmtach_arg->fannumber,retval,reg_val);
-		printf("%s\n",DevNodeFileName);
+		printf("%s\n",path);
 	}
 	(void)sigwrap_close(fd);
 	// printf("%s:rpm value %d\n",__FUNCTION__,ppwmtach_arg->rpmvalue);
 	return retval;
 }
-static int pwmtach_action(  pwmtach_ioctl_data* argp, int command )
+static int pwmtach_action( pwmtach_context_t *ctx, pwmtach_ioctl_data* argp, int command )
 {
 	int retval = 0;
 	// printf("%s, Command 0x%X:Dev:%d,Pwm:0x%X,Fan:0x%x,Tach:0x%X\n",__FUNCTION__,command,argp->dev_id,argp->pwmnumber,argp->fannumber,argp->tachnumber);
 	switch(command)
 	{
 		case SET_DUTY_CYCLE_BY_PWM_CHANNEL:
-			retval = SET_PWM_DUTYCYCLE(argp);
+			retval = SET_PWM_DUTYCYCLE(ctx, argp);
 			break;
 		case SET_DUTY_CYCLE_VALUE_BY_PWM_CHANNEL:
 		case SET_DUTY_CYCLE:
-			retval = SET_PWM_DUTYCYCLE_VALUE(argp);
+			retval = SET_PWM_DUTYCYCLE_VALUE(ctx, argp);
 			break;
 		case GET_TACH_VALUE_BY_TACH_CHANNEL:
-			retval = GET_TACH_SPEED(argp);
+			retval = GET_TACH_SPEED(ctx, argp);
 			break;
 		case GET_TACH_VALUE: //used to get fan speed
 			argp->tachnumber = GET_TACH_NUMBER(argp->fannumber);
-			retval = GET_TACH_SPEED(argp);
+			retval = GET_TACH_SPEED(ctx, argp);
 			break;
 		case GET_DUTY_CYCLE:
-			retval = GET_PWM_DUTYCYCLE(argp);
+			retval = GET_PWM_DUTYCYCLE(ctx, argp);
 			break;
 		case GET_FAN_RPM_RANGE:
 			argp->max_rpm = RPM_MAX;
@@ -239,7 +391,7 @@ static int pwmtach_action(  pwmtach_ioctl_data* argp, int command )
 		case INIT_PWMTACH: //assume that init complete
 			argp->pwmnumber         = GET_PWM_NUMBER(argp);; //since we don't have the fan to pwm mapping, just using direct map for workarround.
 			argp->counterresvalue   = COUNTERRES_DEF; //since driver don't support COUNTERRES, just using default value for workarround.
-			retval = GET_PWM_DUTYCYCLE(argp);
+			retval = GET_PWM_DUTYCYCLE(ctx, argp);
 			break;
 		case END_OF_FUNC_TABLE:
 		default:
@@ -249,181 +401,669 @@ static int pwmtach_action(  pwmtach_ioctl_data* argp, int command )
 	return( retval );
 }
 
-int get_tach_speed ( unsigned int dev_id, unsigned char tach_number, unsigned int *rpm_value )
+int pwmtach_get_tach_speed ( pwmtach_context_t *ctx, unsigned char tach_number, unsigned int *rpm_value )
 {
 	pwmtach_ioctl_data pwmtach_arg;
 	int retval = 0;
 
-	pwmtach_arg.dev_id = dev_id;
+	pwmtach_arg.dev_id = ctx->dev_id;
 	pwmtach_arg.tachnumber = tach_number;
-	retval = pwmtach_action( &pwmtach_arg, GET_TACH_VALUE_BY_TACH_CHANNEL);
+	retval = pwmtach_action( ctx, &pwmtach_arg, GET_TACH_VALUE_BY_TACH_CHANNEL);
 	if(retval != -1)
 		*rpm_value = pwmtach_arg.rpmvalue;
 	return retval;
 }
 
 //Notice: dutycycle_percentage value should be between 1 to 99.
-int set_pwm_dutycycle ( unsigned int dev_id, unsigned char pwm_number, unsigned char dutycycle_percentage )
+int pwmtach_set_pwm_dutycycle ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char dutycycle_percentage )
 {
 	pwmtach_ioctl_data pwmtach_arg;
 	int retval = 0;
 
-	pwmtach_arg.dev_id = dev_id;
+	pwmtach_arg.dev_id = ctx->dev_id;
 	pwmtach_arg.pwmnumber = pwm_number;
 	pwmtach_arg.dutycycle= dutycycle_percentage;
-	retval = pwmtach_action( &pwmtach_arg, SET_DUTY_CYCLE_BY_PWM_CHANNEL);
+	retval = pwmtach_action( ctx, &pwmtach_arg, SET_DUTY_CYCLE_BY_PWM_CHANNEL);
 
 	return retval;
 }
 
 //Notice: dutycycle_value is one byte (0-255)
-int set_pwm_dutycycle_value ( unsigned int dev_id, unsigned char pwm_number, unsigned char dutycycle_value )
+int pwmtach_set_pwm_dutycycle_value ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char dutycycle_value )
 {
 	pwmtach_ioctl_data pwmtach_arg;
 	int retval = 0;
 
-	pwmtach_arg.dev_id = dev_id;
+	pwmtach_arg.dev_id = ctx->dev_id;
 	pwmtach_arg.pwmnumber = pwm_number;
 	pwmtach_arg.dutycycle= dutycycle_value;
-	retval = pwmtach_action( &pwmtach_arg, SET_DUTY_CYCLE_VALUE_BY_PWM_CHANNEL);
+	retval = pwmtach_action( ctx, &pwmtach_arg, SET_DUTY_CYCLE_VALUE_BY_PWM_CHANNEL);
 
 	return retval;
 }
 
-int get_pwm_dutycycle ( unsigned int dev_id, unsigned char pwm_number, unsigned char *dutycycle_percentage )
+int pwmtach_get_pwm_dutycycle ( pwmtach_context_t *ctx, unsigned char pwm_number, unsigned char *dutycycle_percentage )
 {
 	pwmtach_ioctl_data pwmtach_arg;
 	int retval = 0;
 
-	pwmtach_arg.dev_id = dev_id;
+	pwmtach_arg.dev_id = ctx->dev_id;
 	pwmtach_arg.pwmnumber = pwm_number;
-	retval = pwmtach_action(&pwmtach_arg, GET_DUTY_CYCLE);
+	retval = pwmtach_action( ctx, &pwmtach_arg, GET_DUTY_CYCLE);
 	if(retval != -1)
 		*dutycycle_percentage = pwmtach_arg.dutycycle;
 	return retval;
 
 }
 
-int set_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int rpm_value )
+void pwmtach_default_pid_config ( pwmtach_pid_config_t *config )
+{
+	//a fan moves RPM_PER_COUNT per count and takes half a second to a second to follow a step
+	config->kp = 0.012f;
+	config->ki = 0.03f;
+	config->kd = 0.0f;
+	config->sample_ms = 100;
+	config->tolerance_percent = 2.0f;
+	config->settle_samples = 5;
+	config->timeout_ms = 3000;
+}
+
+static void add_ms(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000)
+	{
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * Closed loop control of one fan: a feedforward from the fan's current operating point, corrected by a PID on the tach.
+ * The integral only accumulates while the output is not pinned at 0 or 255 in the direction of the error,
+ * so a target the fan can't reach doesn't wind it up and overshoot on the way back.
+ */
+int pwmtach_control_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int rpm_value,
+		const pwmtach_pid_config_t *config, pwmtach_pid_result_t *result )
 {
-	int retval = 0;
-	unsigned int retries = 20;
-	unsigned char firsttime = 1;
-	unsigned char duty_cycle_increasing = 0;
-	unsigned char reached90percent = 0;
-	unsigned char reached5percent = 0;
-	unsigned long desiredrpm = rpm_value;
 	pwmtach_ioctl_data          pwmtach_arg;
 	pwmtach_data_t* indata = (pwmtach_data_t*) &pwmtach_arg;
+	pwmtach_node_t *tach;
+	pwmtach_node_t *pwm;
+	struct timespec next;
+	unsigned char initial_dutycycle;
+	unsigned char dutycycle;
+	unsigned int rpm = 0;
+	unsigned int elapsed_ms = 0;
+	unsigned int in_tolerance = 0;
+	float error;
+	float previous_rpm;
+	float integral = 0.0f;
+	float derivative;
+	float output;
+	float feedforward;
+	int starting_below;
+	unsigned int tolerance;
 
-	indata->dev_id = dev_id;
+	memset(result, 0, sizeof(*result));
+	//the loop divides by the sample period and counts its timeout in samples
+	if (config->sample_ms == 0)
+	{
+		printf("Fan control sample period must not be zero.\n");
+		return -1;
+	}
+	memset(indata, 0, sizeof(*indata));
+	indata->dev_id = ctx->dev_id;
 	indata->fannumber = fan_number;
 	indata->rpmvalue = rpm_value;
-	indata->counterresvalue = 0;
-	indata->dutycycle = 0;
-	indata->prevdutycycle = 0;
 
-	retval = pwmtach_action( indata, GET_FAN_RPM_RANGE);
+	(void)pwmtach_action( ctx, indata, GET_FAN_RPM_RANGE);
 	if ((rpm_value < indata->min_rpm) || (rpm_value > indata->max_rpm))
 	{
 		printf("Out of range Fan Speed value for fan.\n");
 		return -1;
 	}
-	retval = pwmtach_action ( indata, INIT_PWMTACH );
+	if (pwmtach_action ( ctx, indata, INIT_PWMTACH ) != 0)
+	{
+		return -1;
+	}
+	initial_dutycycle = indata->dutycycle;
 
-	while (retries--)
+	tach = get_cached_node(ctx, GET_TACH_NUMBER(fan_number), PWMTACH_NODE_TACH);
+	pwm = get_cached_node(ctx, indata->pwmnumber, PWMTACH_NODE_PWM);
+	if ((tach == NULL) || (pwm == NULL) || (read_tach_node(tach, &rpm) != 0))
 	{
-		/* Wait for 1 seconds */
-		select_sleep(0,1*1000*1000);
-		if ((retval = pwmtach_action( indata, GET_TACH_VALUE )) != 0)
+		return -1;
+	}
+	//one dutycycle count moves a fan by RPM_PER_COUNT, a band narrower than that may hold no dutycycle at all
+	tolerance = (unsigned int)(rpm_value * config->tolerance_percent / 100.0f);
+	if (tolerance < RPM_PER_COUNT / 2)
+	{
+		tolerance = RPM_PER_COUNT / 2;
+	}
+	starting_below = (rpm < rpm_value);
+	previous_rpm = rpm;
+
+	//scale the dutycycle the fan runs at now, which knows this fan's curve better than its RPM range does
+	if ((initial_dutycycle > 0) && (rpm >= indata->min_rpm / 2))
+	{
+		feedforward = (float)initial_dutycycle * rpm_value / rpm;
+	}
+	else
+	{
+		feedforward = (255.0f * rpm_value) / indata->max_rpm;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (1)
+	{
+		error = (float)rpm_value - (float)rpm;
+		//derivative on the measurement, so a new target doesn't kick the output
+		derivative = -((float)rpm - previous_rpm) * 1000.0f / config->sample_ms;
+		previous_rpm = rpm;
+
+		output = feedforward + config->kp * error + integral + config->kd * derivative;
+		//only the last stretch is integrated, the feedforward covers a large step and the fan's lag would wind it up
+		if ((error <= rpm_value / 10.0f) && (error >= -(rpm_value / 10.0f)) &&
+			!(((output >= 255.0f) && (error > 0)) || ((output <= 0.0f) && (error < 0))))
+		{
+			integral += config->ki * error * config->sample_ms / 1000.0f;
+		}
+		if (output > 255.0f)
 		{
-			indata->dutycycle = indata->prevdutycycle;
-			retval = pwmtach_action( indata, SET_DUTY_CYCLE);
+			output = 255.0f;
+		}
+		else if (output < 0.0f)
+		{
+			output = 0.0f;
+		}
+		dutycycle = (unsigned char)(output + 0.5f);
+		if (write_pwm_node(pwm, dutycycle) != 0)
+		{
+			drop_cached_node(pwm);
 			return -1;
 		}
-		else
+
+		add_ms(&next, config->sample_ms);
+		(void)sigwrap_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		elapsed_ms += config->sample_ms;
+
+		if (read_tach_node(tach, &rpm) != 0)
 		{
-			indata->prevdutycycle = indata->dutycycle;
-			if (indata->rpmvalue > (desiredrpm + 50))
-			{
-				if (indata->dutycycle <= ((indata->counterresvalue*10)/100))
-				{
-					if (reached5percent == 1)
-					{
-						printf("\nSpeed is set to minimum possible speed of %d RPM.\n",indata->rpmvalue);
-						break;
-					}
-					reached5percent = 1;
-				}
-				else
-				{
-					indata->dutycycle -= ((5 * indata->counterresvalue)/100);
-				}
-			}
-			else if (indata->rpmvalue < (desiredrpm - 50))
+			drop_cached_node(tach);
+			(void)write_pwm_node(pwm, initial_dutycycle);
+			return -1;
+		}
+		if (starting_below && (rpm > rpm_value) && (rpm - rpm_value > result->overshoot_rpm))
+		{
+			result->overshoot_rpm = rpm - rpm_value;
+		}
+		else if (!starting_below && (rpm < rpm_value) && (rpm_value - rpm > result->overshoot_rpm))
+		{
+			result->overshoot_rpm = rpm_value - rpm;
+		}
+
+		if ((rpm + tolerance >= rpm_value) && (rpm <= rpm_value + tolerance))
+		{
+			if (in_tolerance == 0)
 			{
-				if (indata->dutycycle >= indata->counterresvalue)
-				{
-					if (reached90percent == 1)
-					{
-						printf("\nSpeed is set to maximum possible speed of %d RPM.\n",indata->rpmvalue);
-						break;
-					}
-					reached90percent = 1;
-				}
-				else
-				{
-					indata->dutycycle += ((5 * indata->counterresvalue)/100);
-				}
+				result->settle_ms = elapsed_ms;
 			}
-			else
+			if (++in_tolerance >= config->settle_samples)
 			{
+				result->settled = 1;
 				break;
 			}
+		}
+		else
+		{
+			in_tolerance = 0;
+		}
+		if (elapsed_ms >= config->timeout_ms)
+		{
+			result->settle_ms = elapsed_ms;
+			break;
+		}
+	}
+	result->final_rpm = rpm;
+	result->final_dutycycle = dutycycle;
+	return 0;
+}
+
+int pwmtach_set_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int rpm_value )
+{
+	pwmtach_pid_config_t config;
+	pwmtach_pid_result_t result;
+
+	pwmtach_default_pid_config(&config);
+	if (pwmtach_control_fan_speed(ctx, fan_number, rpm_value, &config, &result) != 0)
+	{
+		return -1;
+	}
+	if (result.settled)
+	{
+		printf("Fan %d settled at %d RPM in %d ms, overshoot %d RPM, dutycycle %d\n",
+				fan_number, result.final_rpm, result.settle_ms, result.overshoot_rpm, result.final_dutycycle);
+	}
+	else if (result.final_dutycycle == 255)
+	{
+		printf("\nSpeed is set to maximum possible speed of %d RPM.\n", result.final_rpm);
+	}
+	else if (result.final_dutycycle == 0)
+	{
+		printf("\nSpeed is set to minimum possible speed of %d RPM.\n", result.final_rpm);
+	}
+	else
+	{
+		printf("Fan %d did not settle within %d ms, at %d RPM, overshoot %d RPM, dutycycle %d\n",
+				fan_number, result.settle_ms, result.final_rpm, result.overshoot_rpm, result.final_dutycycle);
+	}
+	return 0;
+}
+
+/* Count fan1_input, fan2_input, ... or pwm1, pwm2, ... of a device, stopping at the first one missing */
+static int count_nodes(unsigned int dev_id, unsigned char type, unsigned int max_nodes)
+{
+	char path[64];
+	unsigned char present[(PWMTACH_MAX_TACHS > PWMTACH_MAX_PWMS) ? PWMTACH_MAX_TACHS : PWMTACH_MAX_PWMS] = { 0 };
+	unsigned int limit = (type == PWMTACH_NODE_PWM) ? PWMTACH_MAX_PWMS : PWMTACH_MAX_TACHS;
+	unsigned int number;
+	unsigned int count = 0;
+	DIR *dir;
+	struct dirent *entry;
+	char suffix[8];
+	int matched;
+
+	snprintf(path, sizeof(path), "%s%d", HWMON_DIR "/hwmon", dev_id);
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		printf("%s,%s not exist\n",__FUNCTION__,path);
+		return -1;
+	}
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (type == PWMTACH_NODE_PWM)
+		{
+			//pwmN itself, not pwmN_enable and the like
+			matched = (sscanf(entry->d_name, "pwm%u%7s", &number, suffix) == 1);
+		}
+		else
+		{
+			matched = (sscanf(entry->d_name, "fan%u_%7s", &number, suffix) == 2) && (strcmp(suffix, "input") == 0);
+		}
+		if (matched && (number >= 1) && (number <= limit))
+		{
+			present[number - 1] = 1;
+		}
+	}
+	closedir(dir);
+
+	while ((count < max_nodes) && (count < limit) && present[count])
+	{
+		count++;
+	}
+	return count;
+}
+
+int pwmtach_get_all_tach_speeds ( pwmtach_context_t *ctx, unsigned int *rpm_values, unsigned int max_tachs, unsigned int *tach_count )
+{
+	pwmtach_node_t *node;
+	int count;
+	int tach;
 
-			retval = pwmtach_action (indata, SET_DUTY_CYCLE);
-			printf("After update: dutycycle=%d, rpmvalue=%d\n", indata->dutycycle, indata->rpmvalue);
+	count = count_nodes(ctx->dev_id, PWMTACH_NODE_TACH, max_tachs);
+	if (count < 0)
+	{
+		return -1;
+	}
+	for (tach = 0; tach < count; tach++)
+	{
+		node = get_cached_node(ctx, tach, PWMTACH_NODE_TACH);
+		if (node == NULL)
+		{
+			return -1;
+		}
+		if (read_tach_node(node, &rpm_values[tach]) != 0)
+		{
+			drop_cached_node(node);
+			return -1;
+		}
+	}
+	*tach_count = count;
+	return 0;
+}
 
-			if(indata->prevdutycycle < indata->dutycycle)
-			{       /* Duty Cycle increasing */
-				if ((firsttime == 0) && (duty_cycle_increasing == 0))
+#define MONITOR_TIMER	0xFFFFFFFF
+
+static int take_sample(pwmtach_context_t *ctx, pwmtach_sample_t *sample)
+{
+	unsigned int i;
+
+	clock_gettime(CLOCK_REALTIME, &sample->timestamp);
+	for (i = 0; i < sample->tach_count; i++)
+	{
+		if (read_tach_node(&ctx->tachs[i], &sample->rpm_values[i]) != 0)
+		{
+			drop_cached_node(&ctx->tachs[i]);
+			return -1;
+		}
+	}
+	for (i = 0; i < sample->pwm_count; i++)
+	{
+		if (read_pwm_node(&ctx->pwms[i], &sample->dutycycle_values[i]) != 0)
+		{
+			drop_cached_node(&ctx->pwms[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Watch a node for sysfs_notify. Drivers that never call it simply never wake us,
+ * and nodes that can't be polled at all are left to the timer. */
+static void watch_node(int epfd, pwmtach_node_t *node, unsigned int index)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLPRI;
+	event.data.u32 = index;
+	if ((epoll_ctl(epfd, EPOLL_CTL_ADD, node->fd, &event) != 0) && (errno != EPERM))
+	{
+		printf("%s: can't watch node %d of hwmon%d, errno %d\n",__FUNCTION__,node->number,node->dev_id,errno);
+	}
+}
+
+int pwmtach_monitor ( pwmtach_context_t *ctx, unsigned int interval_ms, unsigned int samples, pwmtach_sample_handler handler, void *user_data )
+{
+	pwmtach_sample_t sample;
+	struct epoll_event events[PWMTACH_MAX_TACHS + PWMTACH_MAX_PWMS + 1];
+	struct epoll_event event;
+	struct itimerspec period;
+	uint64_t expirations;
+	unsigned int taken = 0;
+	unsigned int i;
+	int epfd = -1;
+	int timerfd = -1;
+	int count;
+	int retval = -1;
+
+	if (interval_ms == 0)
+	{
+		printf("%s: interval must be at least 1 ms\n",__FUNCTION__);
+		return -1;
+	}
+
+	memset(&sample, 0, sizeof(sample));
+	count = count_nodes(ctx->dev_id, PWMTACH_NODE_TACH, PWMTACH_MAX_TACHS);
+	if (count < 0)
+	{
+		return -1;
+	}
+	sample.tach_count = count;
+	count = count_nodes(ctx->dev_id, PWMTACH_NODE_PWM, PWMTACH_MAX_PWMS);
+	if (count < 0)
+	{
+		return -1;
+	}
+	sample.pwm_count = count;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if ((epfd < 0) || (timerfd < 0))
+	{
+		printf("%s: can't create epoll or timer fd, errno %d\n",__FUNCTION__,errno);
+		goto done;
+	}
+
+	//open every node once, they stay open for every sample
+	for (i = 0; i < sample.tach_count; i++)
+	{
+		if (get_cached_node(ctx, i, PWMTACH_NODE_TACH) == NULL)
+		{
+			goto done;
+		}
+		watch_node(epfd, &ctx->tachs[i], i);
+	}
+	for (i = 0; i < sample.pwm_count; i++)
+	{
+		if (get_cached_node(ctx, i, PWMTACH_NODE_PWM) == NULL)
+		{
+			goto done;
+		}
+		watch_node(epfd, &ctx->pwms[i], PWMTACH_MAX_TACHS + i);
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = MONITOR_TIMER;
+	period.it_interval.tv_sec = interval_ms / 1000;
+	period.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+	period.it_value = period.it_interval;
+	if ((epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &event) != 0) || (timerfd_settime(timerfd, 0, &period, NULL) != 0))
+	{
+		printf("%s: can't start the timer, errno %d\n",__FUNCTION__,errno);
+		goto done;
+	}
+
+	//first sample right away, then one per timer expiry or driver notification
+	sample.notified = 0;
+	while (1)
+	{
+		if (take_sample(ctx, &sample) != 0)
+		{
+			goto done;
+		}
+		taken++;
+		if ((handler(&sample, user_data) != 0) || ((samples != 0) && (taken >= samples)))
+		{
+			break;
+		}
+
+		count = sigwrap_epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), -1);
+		if (count < 0)
+		{
+			printf("%s: epoll_wait failed, errno %d\n",__FUNCTION__,errno);
+			goto done;
+		}
+		sample.notified = 0;
+		sample.missed = 0;
+		for (i = 0; i < (unsigned int)count; i++)
+		{
+			if (events[i].data.u32 == MONITOR_TIMER)
+			{
+				if (sigwrap_read(timerfd, &expirations, sizeof(expirations)) == sizeof(expirations))
 				{
-					indata->dutycycle = indata->prevdutycycle;
-					retval = pwmtach_action( indata, SET_DUTY_CYCLE);
-					printf("\n");
-					return 0;
+					sample.missed = expirations - 1;
 				}
-				duty_cycle_increasing = 1;
 			}
 			else
-			{       /* Duty Cycle decreasing */
-				if ((firsttime == 0) && (duty_cycle_increasing == 1))
-				{
-					indata->dutycycle = indata->prevdutycycle;
-					retval = pwmtach_action( indata, SET_DUTY_CYCLE);
-					printf("\n");
-					return 0;
-				}
-				duty_cycle_increasing = 0;
+			{
+				sample.notified = 1;
 			}
-			if (firsttime == 1)
-				firsttime = 0;
 		}
-		printf("retry %d : dt=%d, ps=%d, cr=%d\n", retries, indata->dutycycle, indata->prescalervalue, indata->counterresvalue);
 	}
-	return 0;
+	retval = 0;
 
+done:
+	if (timerfd >= 0)
+	{
+		(void)sigwrap_close(timerfd);
+	}
+	if (epfd >= 0)
+	{
+		(void)sigwrap_close(epfd);
+	}
+	return retval;
 }
 
-int get_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int *rpm_value )
+int pwmtach_get_fan_speed ( pwmtach_context_t *ctx, unsigned char fan_number, unsigned int *rpm_value )
 {
 	pwmtach_ioctl_data pwmtach_arg;
 	int retval = 0;
 
-	pwmtach_arg.dev_id = dev_id;
+	pwmtach_arg.dev_id = ctx->dev_id;
 	pwmtach_arg.fannumber = fan_number;
-	retval = pwmtach_action( &pwmtach_arg, GET_TACH_VALUE );
+	retval = pwmtach_action( ctx, &pwmtach_arg, GET_TACH_VALUE );
 	if(retval != -1)
 		*rpm_value = pwmtach_arg.rpmvalue;
 	return retval;
 }
+
+
+//the per device functions share one context per device, created on first use
+static pthread_mutex_t DefaultContextsLock = PTHREAD_MUTEX_INITIALIZER;
+static pwmtach_context_t *DefaultContexts = NULL;
+
+static pwmtach_context_t *lock_default_context(unsigned int dev_id)
+{
+	pwmtach_context_t *ctx;
+
+	pthread_mutex_lock(&DefaultContextsLock);
+	for (ctx = DefaultContexts; ctx != NULL; ctx = ctx->next)
+	{
+		if (ctx->dev_id == dev_id)
+		{
+			break;
+		}
+	}
+	if (ctx == NULL)
+	{
+		ctx = pwmtach_open_context(dev_id);
+		if (ctx != NULL)
+		{
+			ctx->next = DefaultContexts;
+			DefaultContexts = ctx;
+		}
+	}
+	pthread_mutex_unlock(&DefaultContextsLock);
+
+	if (ctx != NULL)
+	{
+		pthread_mutex_lock(&ctx->lock);
+	}
+	return ctx;
+}
+
+void close_pwmtach_nodes ( void )
+{
+	pwmtach_context_t *ctx;
+
+	pthread_mutex_lock(&DefaultContextsLock);
+	for (ctx = DefaultContexts; ctx != NULL; ctx = ctx->next)
+	{
+		pthread_mutex_lock(&ctx->lock);
+		close_context_nodes(ctx);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	pthread_mutex_unlock(&DefaultContextsLock);
+}
+
+int set_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int rpm_value )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_set_fan_speed(ctx, fan_number, rpm_value);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+int get_fan_speed ( unsigned int dev_id, unsigned char fan_number, unsigned int *rpm_value )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_get_fan_speed(ctx, fan_number, rpm_value);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+int get_all_tach_speeds ( unsigned int dev_id, unsigned int *rpm_values, unsigned int max_tachs, unsigned int *tach_count )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_get_all_tach_speeds(ctx, rpm_values, max_tachs, tach_count);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+int get_tach_speed ( unsigned int dev_id, unsigned char tach_number, unsigned int *rpm_value )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_get_tach_speed(ctx, tach_number, rpm_value);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+//Notice: dutycycle_percentage value should be between 1 to 99.
+int set_pwm_dutycycle ( unsigned int dev_id, unsigned char pwm_number, unsigned char dutycycle_percentage )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_set_pwm_dutycycle(ctx, pwm_number, dutycycle_percentage);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+//Notice: dutycycle_value is one byte (0-255)
+int set_pwm_dutycycle_value ( unsigned int dev_id, unsigned char pwm_number, unsigned char dutycycle_value )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_set_pwm_dutycycle_value(ctx, pwm_number, dutycycle_value);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
+
+int get_pwm_dutycycle ( unsigned int dev_id, unsigned char pwm_number, unsigned char *dutycycle_percentage )
+{
+	pwmtach_context_t *ctx;
+	int retval;
+
+	ctx = lock_default_context(dev_id);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+	retval = pwmtach_get_pwm_dutycycle(ctx, pwm_number, dutycycle_percentage);
+	pthread_mutex_unlock(&ctx->lock);
+	return retval;
+}
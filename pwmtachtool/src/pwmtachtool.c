@@ -25,6 +25,8 @@
 typedef enum {
 	SET_FAN_SPEED,
 	GET_FAN_SPEED,
+	GET_ALL_FAN_SPEEDS,
+	MONITOR,
 	SET_PWM_DUTYCYCLE,
 	SET_PWM_DUTYCYCLE_VALUE,
 	GET_PWM_DUTYCYCLE,
@@ -50,6 +52,9 @@ static void ShowUsage ( void )
 	printf("\t\tparameters: <pwm_number> <dutycycle value>\n");
 	printf( "\t--get-pwm-dutycycle:		Get Fan's dutycycle\n");
 	printf( "\t--get-fan-speed:         Get Fan's speed\n" );
+	printf( "\t--get-all-fan-speeds:    Get the speed of every Fan of the device\n" );
+	printf( "\t--monitor:               Print the speed of every Fan and the dutycycle of every PWM, timestamped, until interrupted\n" );
+	printf("\t\tparameters: <interval_ms> [<samples>]\n");
 	printf( "\t--verbose:         Enable Debug messages\n" );
 	printf( "\n" );
 }
@@ -59,9 +64,29 @@ static void Verbose ( char * msg )
 	if (verbose ) printf ( "%s\n" , msg );
 }
 
+static int print_sample ( const pwmtach_sample_t *sample, void *user_data )
+{
+	unsigned int i;
+
+	(void)user_data;
+	printf("%ld.%06ld %s", (long)sample->timestamp.tv_sec, sample->timestamp.tv_nsec / 1000,
+			sample->notified ? "notify" : "timer");
+	if (sample->missed)
+		printf(" missed %u", sample->missed);
+	printf(" rpm");
+	for (i = 0; i < sample->tach_count; i++)
+		printf(" %u", sample->rpm_values[i]);
+	printf(" pwm");
+	for (i = 0; i < sample->pwm_count; i++)
+		printf(" %u", sample->dutycycle_values[i]);
+	printf("\n");
+	fflush(stdout);
+	return 0;
+}
+
 static int process_arguments( int argc, char **argv,
 		unsigned char* fan_num,unsigned int* rpm_value, 
-		unsigned int* dev_id )
+		unsigned int* dev_id, unsigned int* samples )
 {
 	int i = 1;
 
@@ -128,6 +153,24 @@ static int process_arguments( int argc, char **argv,
 		action = GET_FAN_SPEED;
 	}
 
+	else if( strcmp( argv[ i ], "--get-all-fan-speeds" ) == 0 )
+	{
+		action = GET_ALL_FAN_SPEEDS;
+	}
+
+	else if( strcmp( argv[ i ], "--monitor" ) == 0 )
+	{
+		if (argc < 4)
+		{
+			printf("need sampling interval in ms to process request\n");
+			return -1;
+		}
+		*rpm_value = (unsigned int)strtol( argv[ ++i ], NULL, 10);
+		if (argc > 4)
+			*samples = (unsigned int)strtol( argv[ ++i ], NULL, 10);
+		action = MONITOR;
+	}
+
 	else if( strcmp( argv[ i ], "--verbose" ) == 0 )
 		verbose = 1;
 
@@ -138,6 +181,11 @@ int main ( int argc , char* argv [] )
 {
 	unsigned char fannum = 0, property_id = 0;
 	unsigned int rpmvalue = 0;
+	unsigned int rpmvalues[PWMTACH_MAX_TACHS];
+	unsigned int tachcount = 0;
+	unsigned int i;
+	unsigned int samples = 0;
+	pwmtach_context_t *ctx;
 	unsigned char dutycycle = 0;
 	int Value = 0;
 	int ret = 0;
@@ -148,7 +196,7 @@ int main ( int argc , char* argv [] )
 		ShowUsage();
 		return 0;
 	}
-	ret = process_arguments( argc , argv , &fannum, &rpmvalue, &dev_id );
+	ret = process_arguments( argc , argv , &fannum, &rpmvalue, &dev_id, &samples );
 	if (ret != 0)
 	{ 
 		return -1;
@@ -183,6 +231,34 @@ int main ( int argc , char* argv [] )
 			}	
 			printf("Fan %d speed is %d \n", fannum, rpmvalue);
 			break;
+		case GET_ALL_FAN_SPEEDS:
+			Verbose   ("Inside Get All Fan Speeds \n");
+			Value = get_all_tach_speeds (dev_id, rpmvalues, PWMTACH_MAX_TACHS, &tachcount);
+			if ( -1 == Value)
+			{
+				printf ( "Get All Fan Speeds Failed \n"); 
+				return -1;
+			}
+			for (i = 0; i < tachcount; i++)
+			{
+				printf("Fan %d speed is %d \n", i, rpmvalues[i]);
+			}
+			break;
+		case MONITOR:
+			Verbose   ("Inside Monitor \n");
+			ctx = pwmtach_open_context (dev_id);
+			if (ctx == NULL)
+			{
+				return -1;
+			}
+			Value = pwmtach_monitor (ctx, rpmvalue, samples, print_sample, NULL);
+			pwmtach_close_context (ctx);
+			if ( -1 == Value)
+			{
+				printf ( "Monitor Failed \n"); 
+				return -1;
+			}
+			break;
 
 		case SET_PWM_DUTYCYCLE:
 			Verbose   ("Inside Set PWM Dutycycle \n");